@@ -0,0 +1,148 @@
+#ifndef CPPJIEBA_BINARY_IMAGE_HPP
+#define CPPJIEBA_BINARY_IMAGE_HPP
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cassert>
+#include <stdint.h>
+
+namespace cppjieba {
+
+using namespace std;
+
+// Layout of the precompiled images: a header followed by sections of flat
+// PODs, each aligned so that it can be used in place from a mapped file.
+// Images are native endian, a mismatching byte order mark rejects them.
+const size_t IMAGE_MAGIC_LENGTH = 8;
+const size_t IMAGE_MAX_SECTIONS = 16;
+const size_t IMAGE_ALIGNMENT = 64;
+const uint32_t IMAGE_BYTE_ORDER_MARK = 0x01020304;
+
+struct ImageSection {
+  uint64_t offset;
+  uint64_t size; // bytes
+}; // struct ImageSection
+
+struct ImageHeader {
+  char magic[IMAGE_MAGIC_LENGTH];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t sectionCount;
+  uint32_t reserved;
+  ImageSection sections[IMAGE_MAX_SECTIONS];
+}; // struct ImageHeader
+
+class BinaryImageWriter {
+ public:
+  BinaryImageWriter(const char* magic, uint32_t version, size_t sectionCount)
+   : sections_(sectionCount) {
+    assert(strlen(magic) == IMAGE_MAGIC_LENGTH && sectionCount <= IMAGE_MAX_SECTIONS);
+    memset(&header_, 0, sizeof(header_));
+    memcpy(header_.magic, magic, IMAGE_MAGIC_LENGTH);
+    header_.version = version;
+    header_.byteOrder = IMAGE_BYTE_ORDER_MARK;
+    header_.sectionCount = uint32_t(sectionCount);
+  }
+
+  // data is not copied, it must stay alive until Write()
+  template <class T>
+  void SetSection(size_t id, const T* data, size_t count) {
+    assert(id < sections_.size());
+    sections_[id].first = reinterpret_cast<const char*>(data);
+    sections_[id].second = count * sizeof(T);
+  }
+
+  bool Write(const string& path) {
+    uint64_t offset = Align(sizeof(header_));
+    for (size_t i = 0; i < sections_.size(); i++) {
+      header_.sections[i].offset = offset;
+      header_.sections[i].size = sections_[i].second;
+      offset = Align(offset + sections_[i].second);
+    }
+
+    ofstream ofs(path.c_str(), ios::binary | ios::trunc);
+    if (!ofs.is_open()) {
+      return false;
+    }
+    ofs.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+    uint64_t written = sizeof(header_);
+    const char padding[IMAGE_ALIGNMENT] = {0};
+    for (size_t i = 0; i < sections_.size(); i++) {
+      ofs.write(padding, streamsize(header_.sections[i].offset - written));
+      ofs.write(sections_[i].first, streamsize(sections_[i].second));
+      written = header_.sections[i].offset + sections_[i].second;
+    }
+    return bool(ofs.flush());
+  }
+
+ private:
+  static uint64_t Align(uint64_t offset) {
+    return (offset + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+  }
+
+  ImageHeader header_;
+  vector<pair<const char*, size_t> > sections_;
+}; // class BinaryImageWriter
+
+// Validates an image held in memory and hands out its sections.
+class BinaryImageReader {
+ public:
+  BinaryImageReader(): data_(NULL), size_(0) {
+  }
+
+  static bool HasMagic(const void* data, size_t size, const char* magic) {
+    return size >= IMAGE_MAGIC_LENGTH && 0 == memcmp(data, magic, IMAGE_MAGIC_LENGTH);
+  }
+
+  static bool FileHasMagic(const string& path, const char* magic) {
+    char buffer[IMAGE_MAGIC_LENGTH];
+    ifstream ifs(path.c_str(), ios::binary);
+    return ifs.read(buffer, sizeof(buffer)) && HasMagic(buffer, sizeof(buffer), magic);
+  }
+
+  // data must be aligned for the PODs of the sections
+  bool Open(const void* data, size_t size, const char* magic, uint32_t version, size_t sectionCount) {
+    data_ = NULL;
+    size_ = 0;
+    if (reinterpret_cast<uintptr_t>(data) % sizeof(uint64_t) || size < sizeof(ImageHeader) || !HasMagic(data, size, magic)) {
+      return false;
+    }
+    memcpy(&header_, data, sizeof(header_));
+    if (header_.version != version || header_.byteOrder != IMAGE_BYTE_ORDER_MARK || header_.sectionCount != sectionCount) {
+      return false;
+    }
+    for (size_t i = 0; i < sectionCount; i++) {
+      const ImageSection& section = header_.sections[i];
+      if (section.offset % IMAGE_ALIGNMENT || section.offset > size || section.size > size - section.offset) {
+        return false;
+      }
+    }
+    data_ = static_cast<const char*>(data);
+    size_ = size;
+    return true;
+  }
+
+  // NULL if the section does not hold a whole number of T
+  template <class T>
+  const T* GetSection(size_t id, size_t& count) const {
+    assert(data_ && id < header_.sectionCount);
+    const ImageSection& section = header_.sections[id];
+    count = 0;
+    if (section.size % sizeof(T)) {
+      return NULL;
+    }
+    count = size_t(section.size / sizeof(T));
+    return reinterpret_cast<const T*>(data_ + section.offset);
+  }
+
+ private:
+  ImageHeader header_;
+  const char* data_;
+  size_t size_;
+}; // class BinaryImageReader
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_BINARY_IMAGE_HPP
@@ -0,0 +1,361 @@
+#ifndef CPPJIEBA_DAWG_HPP
+#define CPPJIEBA_DAWG_HPP
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
+#include "Trie.hpp"
+
+namespace cppjieba {
+
+using namespace std;
+
+// A state of the automaton with its outgoing arcs, which are sorted by rune.
+struct DawgState {
+  uint32_t firstArc;
+  uint32_t arcCount : 31;
+  uint32_t final : 1;
+}; // struct DawgState
+
+struct DawgArc {
+  Rune rune;
+  uint32_t target;
+  // the words reached through the arcs before this one plus the word ending
+  // in the source state, it numbers the words in lexicographical order
+  uint32_t skip;
+}; // struct DawgArc
+
+// Minimal acyclic automaton of the words (DAWG). Unlike the trie it keeps
+// shared suffixes once, so it needs fewer states for the same words. States
+// cannot carry values when they are shared, so a word is numbered by its rank
+// in lexicographical order while walking it, the rank indexes the values.
+// Read only, a change means building it again.
+class Dawg {
+ public:
+  Dawg(const vector<Unicode>& keys, const vector<const DictUnit*>& valuePointers) {
+    assert(keys.size() == valuePointers.size());
+    Build(keys, valuePointers);
+  }
+
+  const DictUnit* Find(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) const {
+    if (begin == end) {
+      return NULL;
+    }
+    uint32_t state = 0;
+    uint32_t rank = 0;
+    for (RuneStrArray::const_iterator it = begin; it != end; it++) {
+      if (!Transit(state, rank, it->rune)) {
+        return NULL;
+      }
+    }
+    return states_[state].final ? values_[rank] : NULL;
+  }
+
+  // the same DAG as Trie::Find()
+  void Find(RuneStrArray::const_iterator begin,
+        RuneStrArray::const_iterator end,
+        DagLattice& lattice,
+        size_t max_word_len = MAX_WORD_LENGTH) const {
+    lattice.clear();
+    for (size_t i = 0; i < size_t(end - begin); i++) {
+      FindFrom(begin, end, i, max_word_len, lattice.edges);
+      lattice.ClosePosition();
+    }
+  }
+
+  // Appends the edges of position i of the DAG, the words starting there.
+  template <class Edges>
+  void FindFrom(RuneStrArray::const_iterator begin,
+        RuneStrArray::const_iterator end,
+        size_t i,
+        size_t max_word_len,
+        Edges& edges) const {
+    uint32_t state = 0;
+    uint32_t rank = 0;
+    if (!Transit(state, rank, (begin + i)->rune)) {
+      edges.push_back(DagEdge(i, NULL));
+      return;
+    }
+    edges.push_back(DagEdge(i, states_[state].final ? values_[rank] : NULL));
+
+    for (size_t j = i + 1; j < size_t(end - begin) && (j - i + 1) <= max_word_len; j++) {
+      if (!Transit(state, rank, (begin + j)->rune)) {
+        break;
+      }
+      if (states_[state].final && NULL != values_[rank]) {
+        edges.push_back(DagEdge(j, values_[rank]));
+      }
+    }
+  }
+
+  // Adds the words to lattice, the DAG another dictionary built for the same
+  // text. They replace the units found there for the same spans.
+  void Overlay(RuneStrArray::const_iterator begin,
+        RuneStrArray::const_iterator end,
+        DagLattice& lattice,
+        size_t max_word_len = MAX_WORD_LENGTH) const {
+    assert(lattice.size() == size_t(end - begin));
+    DagLattice merged;
+    merged.edges.reserve(lattice.edges.size());
+    DagEdges edges;
+    for (size_t i = 0; i < lattice.size(); i++) {
+      edges.clear();
+      for (const DagEdge* edge = lattice.EdgesBegin(i); edge != lattice.EdgesEnd(i); edge++) {
+        edges.push_back(*edge);
+      }
+      OverlayFrom(begin, end, i, max_word_len, edges);
+      merged.edges.insert(merged.edges.end(), edges.begin(), edges.end());
+      merged.ClosePosition();
+    }
+    lattice.swap(merged);
+  }
+
+  // the same for the edges of position i alone
+  void OverlayFrom(RuneStrArray::const_iterator begin,
+        RuneStrArray::const_iterator end,
+        size_t i,
+        size_t max_word_len,
+        DagEdges& edges) const {
+    uint32_t state = 0;
+    uint32_t rank = 0;
+    for (size_t j = i; j < size_t(end - begin) && (j - i + 1) <= max_word_len; j++) {
+      if (!Transit(state, rank, (begin + j)->rune)) {
+        break;
+      }
+      if (states_[state].final && NULL != values_[rank]) {
+        SetEdge(edges, j, values_[rank]);
+      }
+    }
+  }
+
+  // the values of the words, in no particular order
+  void CollectValues(vector<const DictUnit*>& values) const {
+    values.clear();
+    for (size_t i = 0; i < values_.size(); i++) {
+      if (NULL != values_[i]) {
+        values.push_back(values_[i]);
+      }
+    }
+  }
+
+  // states are shared by words of different lengths, they count at the depth
+  // of their shortest path from the root
+  void GetMemoryStats(MemoryStats& stats) const {
+    stats.Add("states", states_.size(), states_.capacity() * sizeof(DawgState));
+    stats.Add("arcs", arcs_.size(), arcs_.capacity() * sizeof(DawgArc));
+    stats.Add("root_arcs", rootArcs_.size(), rootArcs_.capacity() * sizeof(uint32_t));
+    stats.Add("values", values_.size(), values_.capacity() * sizeof(values_[0]));
+
+    // states are numbered breadth first
+    vector<uint32_t> depths(states_.size(), 0);
+    for (size_t i = 0; i < states_.size(); i++) {
+      for (uint32_t a = states_[i].firstArc; a < states_[i].firstArc + states_[i].arcCount; a++) {
+        uint32_t target = arcs_[a].target;
+        if (target > i && 0 == depths[target]) {
+          depths[target] = depths[i] + 1;
+        }
+      }
+      stats.trieStates++;
+      stats.AddDepth(depths[i]);
+    }
+  }
+
+ private:
+  static const size_t BMP_RUNE_COUNT = 0x10000;
+  // below that many first runes the root arcs are searched like the others
+  static const size_t ROOT_TABLE_MIN_ARCS = 1024;
+
+  // a state while building, arcs point to other build nodes
+  struct BuildNode {
+    bool final;
+    vector<pair<Rune, uint32_t> > arcs;
+    BuildNode(): final(false) {
+    }
+  }; // struct BuildNode
+
+  bool Transit(uint32_t& state, uint32_t& rank, Rune rune) const {
+    const DawgArc* arc = NULL;
+    if (0 == state && rune < rootArcs_.size()) {
+      if (0 == rootArcs_[rune]) {
+        return false;
+      }
+      arc = &arcs_[rootArcs_[rune] - 1];
+    } else {
+      const DawgArc* first = arcs_.data() + states_[state].firstArc;
+      const DawgArc* last = first + states_[state].arcCount;
+      DawgArc item;
+      item.rune = rune;
+      arc = lower_bound(first, last, item, [](const DawgArc& lhs, const DawgArc& rhs) {
+        return lhs.rune < rhs.rune;
+      });
+      if (arc == last || arc->rune != rune) {
+        return false;
+      }
+    }
+    rank += arc->skip;
+    state = arc->target;
+    return true;
+  }
+
+  // Daciuk's incremental construction over the sorted words: the states of
+  // the previous word that the next one does not share are final, so they are
+  // merged with an equal state built before or registered as new.
+  void Build(const vector<Unicode>& keys, const vector<const DictUnit*>& valuePointers) {
+    // later duplicates win, like with the trie
+    vector<size_t> order;
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (!keys[i].empty()) {
+        order.push_back(i);
+      }
+    }
+    stable_sort(order.begin(), order.end(), [&keys](size_t lhs, size_t rhs) {
+      return lexicographical_compare(keys[lhs].begin(), keys[lhs].end(), keys[rhs].begin(), keys[rhs].end());
+    });
+
+    vector<BuildNode> nodes(1);
+    unordered_map<string, uint32_t> registry;
+    vector<pair<uint32_t, uint32_t> > unchecked; // parent, child along the previous word
+    const Unicode* previous = NULL;
+    for (size_t n = 0; n < order.size(); n++) {
+      const Unicode& key = keys[order[n]];
+      if (NULL != previous && key.size() == previous->size() && equal(key.begin(), key.end(), previous->begin())) {
+        values_.back() = valuePointers[order[n]];
+        continue;
+      }
+      size_t common = 0;
+      if (NULL != previous) {
+        while (common < key.size() && common < previous->size() && key[common] == (*previous)[common]) {
+          common++;
+        }
+      }
+      Minimize(nodes, registry, unchecked, common);
+      uint32_t node = unchecked.empty() ? 0 : unchecked.back().second;
+      for (size_t i = common; i < key.size(); i++) {
+        uint32_t child = uint32_t(nodes.size());
+        nodes.push_back(BuildNode());
+        nodes[node].arcs.push_back(make_pair(key[i], child));
+        unchecked.push_back(make_pair(node, child));
+        node = child;
+      }
+      nodes[node].final = true;
+      values_.push_back(valuePointers[order[n]]);
+      previous = &key;
+    }
+    Minimize(nodes, registry, unchecked, 0);
+    registry.clear();
+    Layout(nodes);
+  }
+
+  // edges are sorted by their end
+  static void SetEdge(DagEdges& edges, size_t j, const DictUnit* value) {
+    size_t n = 0;
+    while (n < edges.size() && edges[n].end < j) {
+      n++;
+    }
+    if (n < edges.size() && edges[n].end == j) {
+      edges[n].unit = value;
+      return;
+    }
+    edges.push_back(DagEdge(j, value));
+    for (size_t k = edges.size() - 1; k > n; k--) {
+      swap(edges[k], edges[k - 1]);
+    }
+  }
+
+
+  static void Minimize(vector<BuildNode>& nodes, unordered_map<string, uint32_t>& registry,
+        vector<pair<uint32_t, uint32_t> >& unchecked, size_t depth) {
+    while (unchecked.size() > depth) {
+      uint32_t parent = unchecked.back().first;
+      uint32_t child = unchecked.back().second;
+      unchecked.pop_back();
+      string signature(1, nodes[child].final ? '1' : '0');
+      signature.append(reinterpret_cast<const char*>(nodes[child].arcs.data()), nodes[child].arcs.size() * sizeof(nodes[child].arcs[0]));
+      unordered_map<string, uint32_t>::const_iterator it = registry.find(signature);
+      if (it != registry.end()) {
+        nodes[parent].arcs.back().second = it->second;
+        vector<pair<Rune, uint32_t> >().swap(nodes[child].arcs);
+      } else {
+        registry.insert(make_pair(signature, child));
+      }
+    }
+  }
+
+  // numbers the reachable states breadth first and counts their words
+  void Layout(const vector<BuildNode>& nodes) {
+    vector<uint32_t> ids(nodes.size(), UINT32_MAX);
+    vector<uint32_t> queue(1, 0);
+    ids[0] = 0;
+    size_t arcCount = 0;
+    for (size_t q = 0; q < queue.size(); q++) {
+      const BuildNode& node = nodes[queue[q]];
+      arcCount += node.arcs.size();
+      for (size_t i = 0; i < node.arcs.size(); i++) {
+        uint32_t target = node.arcs[i].second;
+        if (UINT32_MAX == ids[target]) {
+          ids[target] = uint32_t(queue.size());
+          queue.push_back(target);
+        }
+      }
+    }
+
+    // words per state, targets are counted before their sources
+    vector<uint32_t> words(queue.size(), 0);
+    vector<bool> done(queue.size(), false);
+    vector<pair<uint32_t, size_t> > stack(1, make_pair(uint32_t(0), size_t(0)));
+    while (!stack.empty()) {
+      uint32_t node = queue[stack.back().first];
+      size_t& next = stack.back().second;
+      if (next < nodes[node].arcs.size()) {
+        uint32_t target = ids[nodes[node].arcs[next++].second];
+        if (!done[target]) {
+          stack.push_back(make_pair(target, size_t(0)));
+        }
+        continue;
+      }
+      uint32_t id = stack.back().first;
+      words[id] = nodes[node].final ? 1 : 0;
+      for (size_t i = 0; i < nodes[node].arcs.size(); i++) {
+        words[id] += words[ids[nodes[node].arcs[i].second]];
+      }
+      done[id] = true;
+      stack.pop_back();
+    }
+    assert(words[0] == values_.size());
+
+    states_.resize(queue.size());
+    arcs_.reserve(arcCount);
+    if (nodes[0].arcs.size() >= ROOT_TABLE_MIN_ARCS) {
+      rootArcs_.assign(BMP_RUNE_COUNT, 0);
+    }
+    for (size_t q = 0; q < queue.size(); q++) {
+      const BuildNode& node = nodes[queue[q]];
+      states_[q].firstArc = uint32_t(arcs_.size());
+      states_[q].arcCount = uint32_t(node.arcs.size());
+      states_[q].final = node.final ? 1 : 0;
+      uint32_t skip = node.final ? 1 : 0;
+      for (size_t i = 0; i < node.arcs.size(); i++) {
+        DawgArc arc;
+        arc.rune = node.arcs[i].first;
+        arc.target = ids[node.arcs[i].second];
+        arc.skip = skip;
+        skip += words[arc.target];
+        if (0 == q && arc.rune < rootArcs_.size()) {
+          rootArcs_[arc.rune] = uint32_t(arcs_.size() + 1);
+        }
+        arcs_.push_back(arc);
+      }
+    }
+  }
+
+  vector<DawgState> states_;
+  vector<DawgArc> arcs_;
+  vector<uint32_t> rootArcs_; // BMP rune -> root arc + 1, 0 - none, empty for few words
+  vector<const DictUnit*> values_; // by word rank
+}; // class Dawg
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_DAWG_HPP
@@ -10,20 +10,39 @@
 #include <stdint.h>
 #include <cmath>
 #include <limits>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <future>
 #include "limonp/StringUtil.hpp"
 #include "limonp/Logging.hpp"
 #include "Unicode.hpp"
 #include "Trie.hpp"
+#include "Dawg.hpp"
+#include "RcuPointer.hpp"
+#include "ParallelParser.hpp"
+#include "BinaryImage.hpp"
 #include "reader.h"
 
 namespace cppjieba {
 
 using namespace limonp;
 
-const double MIN_DOUBLE = -3.14e+100;
-const double MAX_DOUBLE = 3.14e+100;
 const size_t DICT_COLUMN_NUM = 3;
 const char* const UNKNOWN_TAG = "";
+const char* const DICT_IMAGE_MAGIC = "JIEBADIC";
+const uint32_t DICT_IMAGE_VERSION = 3;
+// tags of an overlay are numbered from here, those of its base below
+const uint16_t OVERLAY_TAG_BASE = 0x8000;
+
+struct DictImageMeta {
+  double freqSum;
+  double minWeight;
+  double maxWeight;
+  double medianWeight;
+  uint32_t alphabetSize;
+  uint32_t reserved;
+}; // struct DictImageMeta
 
 class DictTrie {
  public:
@@ -33,53 +52,191 @@ class DictTrie {
     WordWeightMax,
   }; // enum UserWordWeightOption
 
-  DictTrie(const string& dict_path, const string& user_dict_paths = "", UserWordWeightOption user_word_weight_opt = WordWeightMedian) {
+  // How Find() builds the DAG of a sentence. The automaton costs some memory
+  // and a rebuild on every inserted word, but finds all the words in one pass,
+  // which pays off on long text with dense dictionary coverage.
+  enum DagBuildOption {
+    DagByTrieWalk,
+    DagByAutomaton,
+  }; // enum DagBuildOption
+
+  // How the words are stored. The DAWG keeps shared suffixes once, so it
+  // takes about half the memory of the trie for a Chinese dictionary, but it
+  // cannot be changed in place: every user word update builds it anew, the
+  // DAG is always built by walking it and it cannot be saved as an image.
+  enum StorageOption {
+    StorageTrie,
+    StorageDawg,
+  }; // enum StorageOption
+
+  // dict_path is either a text dictionary or an image written by SaveImage().
+  // Lookups may run concurrently with the user word updates: they read an
+  // immutable version of the trie, updates publish a modified copy.
+  DictTrie(const string& dict_path, const string& user_dict_paths = "", UserWordWeightOption user_word_weight_opt = WordWeightMedian,
+        DagBuildOption dag_build_opt = DagByTrieWalk, StorageOption storage_opt = StorageTrie)
+   : base_(NULL), tag_base_(0), dag_build_opt_(dag_build_opt), storage_opt_(storage_opt) {
+    InternTag(UNKNOWN_TAG);
     Init(dict_path, user_dict_paths, user_word_weight_opt);
   }
 
-  ~DictTrie() {
-    delete trie_;
+  // The dictionary held in memory, e.g. in a storage blob or compiled into
+  // the binary. An image written by SaveImage() is used in place, so it must
+  // outlive the dictionary and be aligned like a mapped file (8 bytes will
+  // do). A text dictionary is parsed straight from the memory and is not
+  // needed afterwards.
+  DictTrie(const void* data, size_t size, const string& user_dict_paths = "", UserWordWeightOption user_word_weight_opt = WordWeightMedian,
+        DagBuildOption dag_build_opt = DagByTrieWalk, StorageOption storage_opt = StorageTrie)
+   : base_(NULL), tag_base_(0), dag_build_opt_(dag_build_opt), storage_opt_(storage_opt) {
+    InternTag(UNKNOWN_TAG);
+    if (BinaryImageReader::HasMagic(data, size, DICT_IMAGE_MAGIC)) {
+      LoadImage(data, size, "memory image", user_dict_paths, user_word_weight_opt);
+      return;
+    }
+    const char* text = static_cast<const char*>(data);
+    InitText(TextSpan(text, text + size), user_dict_paths, user_word_weight_opt);
+  }
+
+  // An overlay holds just its own user words on top of base, which it shares
+  // with other overlays and which must outlive it. Lookups see the words of
+  // both, the overlay words take precedence. Words inserted into or deleted
+  // from the overlay do not touch base, changes of base show through. User
+  // word weights are derived from the weights of base.
+  DictTrie(const DictTrie* base, const string& user_dict_paths = "", UserWordWeightOption user_word_weight_opt = WordWeightMedian)
+   : base_(base), tag_base_(OVERLAY_TAG_BASE), dag_build_opt_(DagByTrieWalk), storage_opt_(StorageDawg) {
+    XCHECK(NULL == base->base_) << "an overlay cannot be the base of another one";
+    freq_sum_ = base->freq_sum_;
+    min_weight_ = base->min_weight_;
+    max_weight_ = base->max_weight_;
+    median_weight_ = base->median_weight_;
+    SetUserWordDefaultWeight(user_word_weight_opt);
+    InternTag(UNKNOWN_TAG);
+    if (user_dict_paths.size()) {
+      LoadStaticUserDict(user_dict_paths);
+    }
+    Shrink(static_node_infos_);
+    Shrink(runes_);
+    vector<const DictUnit*> values(static_node_infos_.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      values[i] = &static_node_infos_[i];
+    }
+    Rebuild(values);
   }
 
   bool InsertUserWord(const string& word, const string& tag = UNKNOWN_TAG) {
+    lock_guard<mutex> lock(write_mutex_);
     DictUnit node_info;
-    if (!MakeNodeInfo(node_info, word, user_word_default_weight_, tag)) {
+    Unicode runes;
+    if (!MakeNodeInfo(node_info, runes, word, user_word_default_weight_, tag)) {
       return false;
     }
     active_node_infos_.push_back(node_info);
-    trie_->InsertNode(node_info.word, &active_node_infos_.back());
+    UpdateWord(runes, &active_node_infos_.back());
     return true;
   }
 
   bool InsertUserWord(const string& word,int freq, const string& tag = UNKNOWN_TAG) {
+    lock_guard<mutex> lock(write_mutex_);
     DictUnit node_info;
+    Unicode runes;
     double weight = freq ? log(1.0 * freq / freq_sum_) : user_word_default_weight_ ;
-    if (!MakeNodeInfo(node_info, word, weight , tag)) {
+    if (!MakeNodeInfo(node_info, runes, word, weight , tag)) {
       return false;
     }
     active_node_infos_.push_back(node_info);
-    trie_->InsertNode(node_info.word, &active_node_infos_.back());
+    UpdateWord(runes, &active_node_infos_.back());
     return true;
   }
 
-  bool DeleteUserWord(const string& word, const string& tag = UNKNOWN_TAG) {
-    DictUnit node_info;
-    if (!MakeNodeInfo(node_info, word, user_word_default_weight_, tag)) {
+  // the word goes whatever its tag, the tag is kept for compatibility
+  bool DeleteUserWord(const string& word, const string& /*tag*/ = UNKNOWN_TAG) {
+    Unicode runes;
+    if (!DecodeRunesInString(word, runes)) {
+      XLOG(ERROR) << "Decode " << word << " failed.";
       return false;
     }
-    trie_->DeleteNode(node_info.word, &node_info);
+    lock_guard<mutex> lock(write_mutex_);
+    UpdateWord(runes, NULL);
     return true;
   }
+
+  // takes the writer lock, the rune pool grows with the inserted words
+  Unicode GetWord(const DictUnit* unit) const {
+    if (unit->tag < tag_base_) {
+      return base_->GetWord(unit);
+    }
+    lock_guard<mutex> lock(write_mutex_);
+    return GetWordLocked(unit);
+  }
+
+  const string& GetTag(const DictUnit* unit) const {
+    if (unit->tag < tag_base_) {
+      return base_->GetTag(unit);
+    }
+    RcuPointer<Version>::ReadGuard version(version_);
+    assert(size_t(unit->tag - tag_base_) < version->tags.size());
+    return *version->tags[unit->tag - tag_base_];
+  }
   
+  // The units found stay valid for the lifetime of the dictionary, also when
+  // their words get deleted meanwhile.
   const DictUnit* Find(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) const {
-    return trie_->Find(begin, end);
+    RcuPointer<Version>::ReadGuard version(version_);
+    if (NULL != version->dawg) {
+      const DictUnit* unit = version->dawg->Find(begin, end);
+      return NULL == unit && NULL != base_ ? base_->Find(begin, end) : unit;
+    }
+    return version->trie->Find(begin, end);
+  }
+
+  void Find(RuneStrArray::const_iterator begin, 
+        RuneStrArray::const_iterator end, 
+        DagLattice& lattice,
+        size_t max_word_len = MAX_WORD_LENGTH) const {
+    if (NULL != base_) {
+      base_->Find(begin, end, lattice, max_word_len);
+      RcuPointer<Version>::ReadGuard version(version_);
+      version->dawg->Overlay(begin, end, lattice, max_word_len);
+      return;
+    }
+    RcuPointer<Version>::ReadGuard version(version_);
+    if (NULL != version->dawg) {
+      version->dawg->Find(begin, end, lattice, max_word_len);
+      return;
+    }
+    version->trie->Find(begin, end, lattice, max_word_len);
   }
 
+  // The same DAG with a Dag per position, which takes much more memory.
   void Find(RuneStrArray::const_iterator begin, 
         RuneStrArray::const_iterator end, 
         vector<struct Dag>&res,
         size_t max_word_len = MAX_WORD_LENGTH) const {
-    trie_->Find(begin, end, res, max_word_len);
+    DagLattice lattice;
+    Find(begin, end, lattice, max_word_len);
+    res.resize(lattice.size());
+    for (size_t i = 0; i < lattice.size(); i++) {
+      res[i].runestr = *(begin + i);
+      res[i].nexts.clear();
+      for (const DagEdge* edge = lattice.EdgesBegin(i); edge != lattice.EdgesEnd(i); edge++) {
+        res[i].nexts.push_back(pair<size_t, const DictUnit*>(edge->end, edge->unit));
+      }
+    }
+  }
+
+  // Calls visit(i, first, last) for the positions from the last one to the
+  // first, [first, last) the edges of the DAG Find() builds, in a buffer
+  // reused for every position. A DP that looks ahead needs no DAG this way. False if
+  // the DAG is built by the automaton, which finds the words by their end.
+  template <class Visit>
+  bool FindBackwards(RuneStrArray::const_iterator begin,
+        RuneStrArray::const_iterator end,
+        size_t max_word_len,
+        Visit& visit) const {
+    if (NULL != base_) {
+      RcuPointer<Version>::ReadGuard version(version_);
+      return base_->FindBackwards(begin, end, max_word_len, visit, version->dawg);
+    }
+    return FindBackwards(begin, end, max_word_len, visit, static_cast<const Dawg*>(NULL));
   }
 
   bool Find(const string& word)
@@ -102,157 +259,608 @@ class DictTrie {
   }
 
   bool IsUserDictSingleChineseWord(const Rune& word) const {
-    return IsIn(user_dict_single_chinese_word_, word);
+    {
+      RcuPointer<Version>::ReadGuard version(version_);
+      if (IsIn(*version->singles, word)) {
+        return true;
+      }
+    }
+    return NULL != base_ && base_->IsUserDictSingleChineseWord(word);
   }
 
   double GetMinWeight() const {
     return min_weight_;
   }
 
+  // What the dictionary takes, the trie or DAWG usages start with "trie.".
+  // The base of an overlay is not included.
+  void GetMemoryStats(MemoryStats& stats) const {
+    lock_guard<mutex> lock(write_mutex_);
+    stats.Add("static_node_infos", static_node_infos_.size(), static_node_infos_.size() * sizeof(DictUnit), !static_node_infos_.IsOwner());
+    stats.Add("active_node_infos", active_node_infos_.size(), active_node_infos_.size() * sizeof(DictUnit));
+    stats.Add("runes", runes_.size(), runes_.size() * sizeof(Rune), !runes_.IsOwner());
+    size_t tag_bytes = 0;
+    for (size_t i = 0; i < tags_.size(); i++) {
+      tag_bytes += sizeof(string) + HeapBytes(tags_[i]);
+    }
+    stats.Add("tags", tags_.size(), tag_bytes + HashTableBytes(tag_ids_));
+    stats.Add("single_rune_words", user_dict_single_chinese_word_.size(), HashTableBytes(user_dict_single_chinese_word_));
+
+    const Version* version = version_.Get();
+    MemoryStats storage;
+    if (NULL != version->dawg) {
+      version->dawg->GetMemoryStats(storage);
+    } else {
+      version->trie->GetMemoryStats(storage);
+    }
+    stats.Merge("trie.", storage);
+  }
+
   void InserUserDictNode(const string& line) {
-    vector<string> buf;
-    DictUnit node_info;
-    Split(line, buf, " ");
-    if(buf.size() == 1){
-          MakeNodeInfo(node_info, 
-                buf[0], 
-                user_word_default_weight_,
-                UNKNOWN_TAG);
-        } else if (buf.size() == 2) {
-          MakeNodeInfo(node_info, 
-                buf[0], 
-                user_word_default_weight_,
-                buf[1]);
-        } else if (buf.size() == 3) {
-          int freq = atoi(buf[1].c_str());
-          assert(freq_sum_ > 0.0);
-          double weight = log(1.0 * freq / freq_sum_);
-          MakeNodeInfo(node_info, buf[0], weight, buf[2]);
-        }
-        static_node_infos_.push_back(node_info);
-        if (node_info.word.size() == 1) {
-          user_dict_single_chinese_word_.insert(node_info.word[0]);
-        }
+    AddUserDictLines(vector<string>(1, line));
   }
   
+  // The user dictionary lines are merged with the words present into a fresh
+  // trie, which is built aside and swapped in. Lookups go on with the previous
+  // trie meanwhile, other updates wait.
   void LoadUserDict(const vector<string>& buf) {
-    for (size_t i = 0; i < buf.size(); i++) {
-      InserUserDictNode(buf[i]);
-    }
+    AddUserDictLines(buf);
   }
 
    void LoadUserDict(const set<string>& buf) {
-    std::set<string>::const_iterator iter;
-    for (iter = buf.begin(); iter != buf.end(); iter++){
-      InserUserDictNode(*iter);
-    }
+    AddUserDictLines(vector<string>(buf.begin(), buf.end()));
   }
 
   void LoadUserDict(const string& filePaths) {
+    vector<string> lines;
+    ReadUserDict(filePaths, lines);
+    AddUserDictLines(lines);
+  }
+
+  // a user dictionary held in memory, it is not needed afterwards
+  void LoadUserDict(const TextSpan& text) {
+    vector<string> lines;
+    TextSpan line;
+    for (const char* cursor = text.begin; NextLine(cursor, text.end, line);) {
+      lines.push_back(line.str());
+    }
+    AddUserDictLines(lines);
+  }
+
+  // LoadUserDict() on a thread of its own, the dictionary must outlive it
+  future<void> LoadUserDictAsync(const string& filePaths) {
+    return async(launch::async, [this, filePaths]() {
+      LoadUserDict(filePaths);
+    });
+  }
+
+  future<void> LoadUserDictAsync(const vector<string>& buf) {
+    return async(launch::async, [this, buf]() {
+      LoadUserDict(buf);
+    });
+  }
+
+  // Writes the weighted words and the trie into a versioned binary image that
+  // later loads map read-only and use in place. Runtime inserted words are
+  // included, deleted ones are not.
+  bool SaveImage(const string& image_path) const {
+    lock_guard<mutex> lock(write_mutex_);
+    const Trie* trie = version_.Get()->trie;
+    if (NULL != base_) {
+      XLOG(ERROR) << "an overlay cannot be saved as an image.";
+      return false;
+    }
+    if (NULL == trie) {
+      XLOG(ERROR) << "a dictionary stored in a DAWG cannot be saved as an image.";
+      return false;
+    }
+    TrieImage trie_image;
+    trie->GetImage(trie_image);
+    const vector<const DictUnit*>& values = trie->GetValues();
+
+    vector<uint32_t> entry_ids(values.size(), 0);
+    vector<DictUnit> entries;
+    for (size_t i = 1; i < values.size(); i++) {
+      if (NULL != values[i]) {
+        entries.push_back(*values[i]);
+        entry_ids[i] = uint32_t(entries.size());
+      }
+    }
+    string tags;
+    for (size_t i = 0; i < tags_.size(); i++) {
+      tags.append(tags_[i].c_str(), tags_[i].size() + 1);
+    }
+
+    // values become entry numbers, free slots are zeroed so that images are reproducible
+    vector<TrieUnit> units(trie_image.units, trie_image.units + trie_image.unitCount);
+    for (size_t i = 0; i < units.size(); i++) {
+      if (units[i].check < 0) {
+        units[i] = TrieUnit();
+      } else {
+        units[i].value = entry_ids[units[i].value];
+      }
+    }
+    vector<Rune> singles(user_dict_single_chinese_word_.begin(), user_dict_single_chinese_word_.end());
+    sort(singles.begin(), singles.end());
+
+    DictImageMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.freqSum = freq_sum_;
+    meta.minWeight = min_weight_;
+    meta.maxWeight = max_weight_;
+    meta.medianWeight = median_weight_;
+    meta.alphabetSize = trie_image.alphabetSize;
+
+    BinaryImageWriter writer(DICT_IMAGE_MAGIC, DICT_IMAGE_VERSION, ImageSectionNum);
+    writer.SetSection(ImageMeta, &meta, 1);
+    writer.SetSection(ImageUnits, units.data(), units.size());
+    writer.SetSection(ImageBmpCodes, trie_image.bmpCodes, 0x10000);
+    writer.SetSection(ImageRoots, trie_image.roots, 0x10000);
+    writer.SetSection(ImageSupplementaryCodes, trie_image.supplementaryCodes, trie_image.supplementaryCount);
+    writer.SetSection(ImageEntries, entries.data(), entries.size());
+    writer.SetSection(ImageRunes, runes_.data(), runes_.size());
+    writer.SetSection(ImageTags, tags.data(), tags.size());
+    writer.SetSection(ImageSingleRunes, singles.data(), singles.size());
+    if (!writer.Write(image_path)) {
+      XLOG(ERROR) << "write " << image_path << " failed.";
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  // overlay - the words of an overlay on top of this dictionary, may be NULL
+  template <class Visit>
+  bool FindBackwards(RuneStrArray::const_iterator begin,
+        RuneStrArray::const_iterator end,
+        size_t max_word_len,
+        Visit& visit,
+        const Dawg* overlay) const {
+    RcuPointer<Version>::ReadGuard version(version_);
+    if (NULL == version->dawg && version->trie->HasAutomaton()) {
+      return false;
+    }
+    DagEdges edges;
+    for (size_t i = end - begin; i-- > 0;) {
+      edges.clear();
+      if (NULL != version->dawg) {
+        version->dawg->FindFrom(begin, end, i, max_word_len, edges);
+      } else {
+        version->trie->FindFrom(begin, end, i, max_word_len, edges);
+      }
+      if (NULL != overlay) {
+        overlay->OverlayFrom(begin, end, i, max_word_len, edges);
+      }
+      visit(i, edges.begin(), edges.end());
+    }
+    return true;
+  }
+
+  enum ImageSectionId {
+    ImageMeta,
+    ImageUnits,
+    ImageBmpCodes,
+    ImageSupplementaryCodes,
+    ImageEntries,
+    ImageRunes,
+    ImageTags,
+    ImageSingleRunes,
+    ImageRoots,
+    ImageSectionNum,
+  }; // enum ImageSectionId
+
+  // What the lookups see of the dictionary. The units the words point to are
+  // shared by all versions and only freed with the dictionary.
+  struct Version {
+    explicit Version(Trie* trie): trie(trie), dawg(NULL) {
+    }
+    explicit Version(Dawg* dawg): trie(NULL), dawg(dawg) {
+    }
+    Version(const Version& other)
+     : trie(other.trie ? new Trie(*other.trie) : NULL), dawg(other.dawg ? new Dawg(*other.dawg) : NULL),
+       tags(other.tags), singles(other.singles) {
+    }
+    ~Version() {
+      delete trie;
+      delete dawg;
+    }
+
+    void CollectValues(vector<const DictUnit*>& values) const {
+      if (NULL != dawg) {
+        dawg->CollectValues(values);
+      } else {
+        trie->CollectValues(values);
+      }
+    }
+
+    Trie* trie; // one of the two is set, see StorageOption
+    Dawg* dawg;
+    vector<const string*> tags; // into tags_, which never moves them
+    shared_ptr<const unordered_set<Rune> > singles; // user words of a single rune
+  }; // struct Version
+
+  // what one thread parses of a text dictionary
+  struct DictChunk {
+    vector<DictUnit> units;
+    vector<Rune> runes;
+    vector<string> tags;
+    string error; // the line that stopped the parse
+  }; // struct DictChunk
+
+  // publishes version with the tags interned so far, the writer lock is held
+  void Publish(Version* version) {
+    for (size_t i = version->tags.size(); i < tags_.size(); i++) {
+      version->tags.push_back(&tags_[i]);
+    }
+    if (!version->singles) {
+      version->singles = make_shared<const unordered_set<Rune> >(user_dict_single_chinese_word_);
+    }
+    version_.Publish(version);
+  }
+
+  // Inserts unit for runes, deletes the word if unit is NULL. The trie is
+  // changed on a copy, a DAWG is built anew.
+  void UpdateWord(const Unicode& runes, const DictUnit* unit) {
+    const Version* current = version_.Get();
+    if (NULL != current->trie) {
+      Version* version = new Version(*current);
+      if (NULL != unit) {
+        version->trie->InsertNode(runes, unit);
+      } else {
+        version->trie->DeleteNode(runes, NULL);
+      }
+      Publish(version);
+      return;
+    }
+    vector<const DictUnit*> values;
+    current->CollectValues(values);
+    if (NULL != unit) {
+      values.push_back(unit);
+    } else {
+      Unicode word;
+      for (size_t i = 0; i < values.size(); i++) {
+        word = GetWordLocked(values[i]);
+        if (word.size() == runes.size() && equal(word.begin(), word.end(), runes.begin())) {
+          values.erase(values.begin() + i);
+          break;
+        }
+      }
+    }
+    Rebuild(values);
+  }
+
+  // publishes storage of the values built from scratch, later duplicates win
+  void Rebuild(const vector<const DictUnit*>& values) {
+    vector<Unicode> words(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      words[i] = GetWordLocked(values[i]);
+    }
+    Publish(BuildVersion(words, values));
+  }
+
+  Version* BuildVersion(const vector<Unicode>& words, const vector<const DictUnit*>& values) const {
+    if (StorageDawg == storage_opt_) {
+      return new Version(new Dawg(words, values));
+    }
+    Trie* trie = new Trie(words, values);
+    if (DagByAutomaton == dag_build_opt_) {
+      trie->BuildAutomaton();
+    }
+    return new Version(trie);
+  }
+
+  void AddUserDictLines(const vector<string>& lines) {
+    lock_guard<mutex> lock(write_mutex_);
+    vector<const DictUnit*> values;
+    version_.Get()->CollectValues(values);
+    values.reserve(values.size() + lines.size());
+    for (size_t i = 0; i < lines.size(); i++) {
+      DictUnit node_info;
+      if (!MakeUserNodeInfo(node_info, lines[i])) {
+        continue;
+      }
+      active_node_infos_.push_back(node_info);
+      values.push_back(&active_node_infos_.back());
+    }
+
+    // the new words come last, so they replace the ones present
+    Rebuild(values);
+  }
+
+  void ReadUserDict(const string& filePaths, vector<string>& lines) const {
     vector<string> files = limonp::Split(filePaths, "|;");
-    size_t lineno = 0;
     for (size_t i = 0; i < files.size(); i++) {
       ifstream ifs(files[i].c_str());
       XCHECK(ifs.is_open()) << "open " << files[i] << " failed"; 
       string line;
-      
-      for (; getline(ifs, line); lineno++) {
-        if (line.size() == 0) {
-          continue;
-        }
-        InserUserDictNode(line);
+      while (getline(ifs, line)) {
+        lines.push_back(line);
       }
     }
   }
 
+  // the user words of the dictionary being constructed go with the static ones
+  void LoadStaticUserDict(const string& filePaths) {
+    vector<string> lines;
+    ReadUserDict(filePaths, lines);
+    for (size_t i = 0; i < lines.size(); i++) {
+      DictUnit node_info;
+      if (MakeUserNodeInfo(node_info, lines[i])) {
+        static_node_infos_.push_back(node_info);
+      }
+    }
+  }
+
+  // a user dictionary line is "word [freq] [tag]", empty lines are skipped
+  bool MakeUserNodeInfo(DictUnit& node_info, const string& line) {
+    if (line.empty()) {
+      return false;
+    }
+    vector<string> buf;
+    Unicode runes;
+    Split(line, buf, " ");
+    bool ok = false;
+    if (buf.size() == 1) {
+      ok = MakeNodeInfo(node_info, runes, buf[0], user_word_default_weight_, UNKNOWN_TAG);
+    } else if (buf.size() == 2) {
+      ok = MakeNodeInfo(node_info, runes, buf[0], user_word_default_weight_, buf[1]);
+    } else if (buf.size() == 3) {
+      int freq = atoi(buf[1].c_str());
+      assert(freq_sum_ > 0.0);
+      double weight = log(1.0 * freq / freq_sum_);
+      ok = MakeNodeInfo(node_info, runes, buf[0], weight, buf[2]);
+    } else {
+      XLOG(ERROR) << "user dict line illegal: " << line;
+    }
+    if (ok && node_info.wordLength == 1) {
+      user_dict_single_chinese_word_.insert(runes[0]);
+    }
+    return ok;
+  }
+
+  Unicode GetWordLocked(const DictUnit* unit) const {
+    assert(unit->wordOffset + unit->wordLength <= runes_.size());
+    return Unicode(runes_.begin() + unit->wordOffset, runes_.begin() + unit->wordOffset + unit->wordLength);
+  }
 
- private:
   void Init(const string& dict_path, const string& user_dict_paths, UserWordWeightOption user_word_weight_opt) {
-    LoadDict(dict_path);
+    if (BinaryImageReader::FileHasMagic(dict_path, DICT_IMAGE_MAGIC)) {
+      LoadImage(dict_path, user_dict_paths, user_word_weight_opt);
+      return;
+    }
+    FileUtil::MappedFile_c file;
+    XCHECK(file.Open(dict_path)) << "open " << dict_path << " failed.";
+    const char* data = reinterpret_cast<const char*>(file.GetData());
+    InitText(TextSpan(data, data + file.GetSize()), user_dict_paths, user_word_weight_opt);
+  }
+
+  void InitText(const TextSpan& text, const string& user_dict_paths, UserWordWeightOption user_word_weight_opt) {
+    LoadDict(text);
     freq_sum_ = CalcFreqSum(static_node_infos_);
     CalculateWeight(static_node_infos_, freq_sum_);
     SetStaticWordWeights(user_word_weight_opt);
 
     if (user_dict_paths.size()) {
-      LoadUserDict(user_dict_paths);
+      LoadStaticUserDict(user_dict_paths);
     }
     Shrink(static_node_infos_);
+    Shrink(runes_);
     CreateTrie(static_node_infos_);
   }
   
-  void CreateTrie(const vector<DictUnit>& dictUnits) {
+  void LoadImage(const string& image_path, const string& user_dict_paths, UserWordWeightOption user_word_weight_opt) {
+    XCHECK(image_file_.Open(image_path)) << "open " << image_path << " failed.";
+    LoadImage(image_file_.GetData(), image_file_.GetSize(), image_path, user_dict_paths, user_word_weight_opt);
+  }
+
+  // The trie runs on the arrays of the image, only the entries are unpacked.
+  void LoadImage(const void* data, size_t size, const string& image_path, const string& user_dict_paths,
+        UserWordWeightOption user_word_weight_opt) {
+    BinaryImageReader image;
+    XCHECK(image.Open(data, size, DICT_IMAGE_MAGIC, DICT_IMAGE_VERSION, ImageSectionNum))
+      << image_path << " is not a dictionary image of version " << DICT_IMAGE_VERSION;
+
+    size_t count = 0;
+    const DictImageMeta* meta = image.GetSection<DictImageMeta>(ImageMeta, count);
+    XCHECK(meta && 1 == count) << "broken dictionary image " << image_path;
+    freq_sum_ = meta->freqSum;
+    min_weight_ = meta->minWeight;
+    max_weight_ = meta->maxWeight;
+    median_weight_ = meta->medianWeight;
+    SetUserWordDefaultWeight(user_word_weight_opt);
+
+    size_t rune_count = 0;
+    const Rune* runes = image.GetSection<Rune>(ImageRunes, rune_count);
+    size_t tags_size = 0;
+    const char* tags = image.GetSection<char>(ImageTags, tags_size);
+    XCHECK(runes && tags && tags_size && '\0' == tags[tags_size - 1]) << "broken dictionary image " << image_path;
+    runes_.Map(runes, rune_count);
+    tags_.clear();
+    tag_ids_.clear();
+    // the last tag ends the section, so every strlen() stays within it
+    for (size_t i = 0; i < tags_size; i += strlen(tags + i) + 1) {
+      size_t tag_count = tags_.size();
+      InternTag(tags + i);
+      // entries refer to tags by their position, a duplicate would shift them
+      XCHECK(tags_.size() == tag_count + 1) << "broken dictionary image " << image_path;
+    }
+
+    size_t entry_count = 0;
+    const DictUnit* entries = image.GetSection<DictUnit>(ImageEntries, entry_count);
+    XCHECK(entries && entry_count) << "broken dictionary image " << image_path;
+    for (size_t i = 0; i < entry_count; i++) {
+      const DictUnit& entry = entries[i];
+      XCHECK(entry.wordOffset <= rune_count && entry.wordLength <= rune_count - entry.wordOffset && entry.tag < tags_.size())
+        << "broken dictionary image " << image_path;
+    }
+
+    const Rune* singles = image.GetSection<Rune>(ImageSingleRunes, count);
+    XCHECK(singles) << "broken dictionary image " << image_path;
+    user_dict_single_chinese_word_.insert(singles, singles + count);
+
+    TrieImage trie_image;
+    trie_image.alphabetSize = meta->alphabetSize;
+    trie_image.units = image.GetSection<TrieUnit>(ImageUnits, trie_image.unitCount);
+    trie_image.supplementaryCodes = image.GetSection<TrieCode>(ImageSupplementaryCodes, trie_image.supplementaryCount);
+    trie_image.bmpCodes = image.GetSection<uint32_t>(ImageBmpCodes, count);
+    XCHECK(trie_image.units && trie_image.unitCount && trie_image.supplementaryCodes && trie_image.bmpCodes && 0x10000 == count)
+      << "broken dictionary image " << image_path;
+    trie_image.roots = image.GetSection<TrieRoot>(ImageRoots, count);
+    XCHECK(trie_image.roots && 0x10000 == count) << "broken dictionary image " << image_path;
+    XCHECK(Trie::IsValidImage(trie_image, entry_count + 1)) << "broken dictionary image " << image_path;
+
+    // User words come on top of the image. They are kept apart from the mapped
+    // entries, but they make the rune pool and the trie take a private copy.
+    if (user_dict_paths.size()) {
+      LoadStaticUserDict(user_dict_paths);
+    }
+    active_node_infos_.assign(static_node_infos_.begin(), static_node_infos_.end());
+    static_node_infos_.Map(entries, entry_count);
+    vector<const DictUnit*> values(entry_count + 1, static_cast<const DictUnit*>(NULL));
+    for (size_t i = 0; i < entry_count; i++) {
+      values[i + 1] = static_node_infos_.data() + i;
+    }
+    Trie* trie = new Trie(trie_image, values);
+    for (size_t i = 0; i < active_node_infos_.size(); i++) {
+      trie->InsertNode(GetWordLocked(&active_node_infos_[i]), &active_node_infos_[i]);
+    }
+    Publish(new Version(trie));
+    if (StorageDawg == storage_opt_) {
+      vector<const DictUnit*> live;
+      trie->CollectValues(live);
+      Rebuild(live);
+    } else if (DagByAutomaton == dag_build_opt_) {
+      version_.Get()->trie->BuildAutomaton();
+    }
+  }
+
+  void CreateTrie(const FlatArray<DictUnit>& dictUnits) {
     assert(dictUnits.size());
     vector<Unicode> words;
     vector<const DictUnit*> valuePointers;
     words.resize(dictUnits.size());
     valuePointers.resize(dictUnits.size());
     for (size_t i = 0 ; i < dictUnits.size(); i ++) {
-      words[i] = dictUnits[i].word;
+      words[i] = GetWordLocked(&dictUnits[i]);
       valuePointers[i] = &dictUnits[i];
     }
 
-    trie_ = new Trie(words, valuePointers);
+    Publish(BuildVersion(words, valuePointers));
   }
 
-  
-
+  uint16_t InternTag(const string& tag) {
+    unordered_map<string, uint16_t>::const_iterator it = tag_ids_.find(tag);
+    if (it != tag_ids_.end()) {
+      return it->second;
+    }
+    XCHECK(tags_.size() < OVERLAY_TAG_BASE) << "too many tags";
+    uint16_t id = uint16_t(tag_base_ + tags_.size());
+    tag_ids_[tag] = id;
+    tags_.push_back(tag);
+    return id;
+  }
 
+  // the word goes to the rune pool, runes receives a copy of it
   bool MakeNodeInfo(DictUnit& node_info,
+        Unicode& runes,
         const string& word, 
         double weight, 
         const string& tag) {
-    if (!DecodeRunesInString(word, node_info.word)) {
+    if (!DecodeRunesInString(word, runes)) {
       XLOG(ERROR) << "Decode " << word << " failed.";
       return false;
     }
-    node_info.weight = weight;
-    node_info.tag = tag;
-    return true;
+    return MakeNodeInfo(node_info, runes, weight, tag);
   }
 
-    bool MakeNodeInfo(DictUnit& node_info,
-        const char * word,
-        double weight,
-        const char * tag )
-  {
-    if (!DecodeRunesInString(word, node_info.word)) {
-      XLOG(ERROR) << "Decode " << word << " failed.";
+  bool MakeNodeInfo(DictUnit& node_info, const Unicode& runes, double weight, const string& tag) {
+    if (runes.size() > numeric_limits<uint16_t>::max()) {
+      XLOG(ERROR) << "word of " << runes.size() << " runes is too long.";
       return false;
     }
-    node_info.weight = weight;
-    node_info.tag = tag;
+    node_info.wordOffset = uint32_t(runes_.size());
+    node_info.wordLength = uint16_t(runes.size());
+    node_info.tag = InternTag(tag);
+    node_info.weight = float(weight);
+    for (Unicode::const_iterator it = runes.begin(); it != runes.end(); ++it) {
+      runes_.push_back(*it);
+    }
     return true;
   }
 
-  void LoadDict(const string& filePath)
-  {
-    FileUtil::FileReader_c tReader;
-    bool bOpenOk = tReader.Open(filePath);
-    XCHECK(bOpenOk) << "open " << filePath << " failed.";
-
-    std::streamsize fileSize = 0;
-    std::ifstream tmpFile ( filePath, std::ios::binary | std::ios::ate );
-    if ( tmpFile.is_open() )
-        fileSize = tmpFile.tellg();
-
-    const int AVG_LINE_LEN = 15;
-    static_node_infos_.reserve ( fileSize/AVG_LINE_LEN );
-
-    DictUnit node_info;
-    const int MAX_LINE_LEN = 1024;
-    char dBuffer[MAX_LINE_LEN];
-    char * dValues[DICT_COLUMN_NUM];
+  // The text is parsed in line aligned chunks, one thread each. The chunks
+  // are merged in text order, so the units come out as if the text had been
+  // read line by line.
+  void LoadDict(const TextSpan& text) {
+    vector<TextSpan> spans;
+    SplitIntoLineChunks(text.begin, text.size(), spans);
+    vector<DictChunk> chunks(spans.size());
+    ParseChunksInParallel(spans, [&chunks](size_t i, const TextSpan& span) {
+      ParseDictChunk(span, chunks[i]);
+    });
+
+    size_t unit_count = 0;
+    size_t rune_count = runes_.size();
+    for (size_t i = 0; i < chunks.size(); i++) {
+      XCHECK(chunks[i].error.empty()) << "split result illegal, line:" << chunks[i].error;
+      unit_count += chunks[i].units.size();
+      rune_count += chunks[i].runes.size();
+    }
+    XCHECK(rune_count <= numeric_limits<uint32_t>::max()) << "the dictionary is too big.";
+    static_node_infos_.reserve(static_node_infos_.size() + unit_count);
+    runes_.reserve(rune_count);
+    for (size_t i = 0; i < chunks.size(); i++) {
+      const DictChunk& chunk = chunks[i];
+      vector<uint16_t> tag_ids(chunk.tags.size());
+      for (size_t j = 0; j < chunk.tags.size(); j++) {
+        tag_ids[j] = InternTag(chunk.tags[j]);
+      }
+      uint32_t offset = uint32_t(runes_.size());
+      for (size_t j = 0; j < chunk.runes.size(); j++) {
+        runes_.push_back(chunk.runes[j]);
+      }
+      for (size_t j = 0; j < chunk.units.size(); j++) {
+        DictUnit unit = chunk.units[j];
+        unit.wordOffset += offset;
+        unit.tag = tag_ids[unit.tag];
+        static_node_infos_.push_back(unit);
+      }
+    }
+  }
 
-    int iLen = 0;
-    while ( ( iLen = tReader.GetLine ( dBuffer, sizeof(dBuffer) ) )>=0 )
-    {
-      bool bSplitOk = SplitText ( dBuffer, iLen, dValues, DICT_COLUMN_NUM );
-      XCHECK(bSplitOk) << "split result illegal, line:" << dBuffer;
-      MakeNodeInfo(node_info, 
-            dValues[0], 
-            atof(dValues[1]), 
-            dValues[2]);
-      static_node_infos_.push_back(node_info);
+  // Lines are "word freq tag", the weights are still frequencies and the
+  // tags index chunk.tags.
+  static void ParseDictChunk(const TextSpan& text, DictChunk& chunk) {
+    unordered_map<string, uint16_t> tag_ids;
+    TextSpan line;
+    TextSpan fields[DICT_COLUMN_NUM];
+    for (const char* cursor = text.begin; NextLine(cursor, text.end, line);) {
+      if (line.empty()) {
+        continue;
+      }
+      double freq = 0.0;
+      if (DICT_COLUMN_NUM != SplitSpan(line, ' ', fields, DICT_COLUMN_NUM) || !ParseDouble(fields[1], freq)) {
+        chunk.error = line.str();
+        return;
+      }
+      DictUnit unit;
+      unit.wordOffset = uint32_t(chunk.runes.size());
+      if (!AppendRunes(fields[0], chunk.runes) || chunk.runes.size() - unit.wordOffset > numeric_limits<uint16_t>::max()) {
+        XLOG(ERROR) << "Decode " << fields[0].str() << " failed.";
+        chunk.runes.resize(unit.wordOffset);
+        continue;
+      }
+      unit.wordLength = uint16_t(chunk.runes.size() - unit.wordOffset);
+      unit.weight = float(freq);
+      string tag = fields[2].str();
+      unordered_map<string, uint16_t>::const_iterator it = tag_ids.find(tag);
+      if (it == tag_ids.end()) {
+        XCHECK(chunk.tags.size() <= numeric_limits<uint16_t>::max()) << "too many tags";
+        it = tag_ids.insert(make_pair(tag, uint16_t(chunk.tags.size()))).first;
+        chunk.tags.push_back(tag);
+      }
+      unit.tag = it->second;
+      chunk.units.push_back(unit);
     }
   }
 
@@ -267,6 +875,10 @@ class DictTrie {
     min_weight_ = static_node_infos_[indices.front()].weight;
     max_weight_ = static_node_infos_[indices.back()].weight;
     median_weight_ = static_node_infos_[indices[indices.size() / 2]].weight;
+    SetUserWordDefaultWeight(option);
+  }
+
+  void SetUserWordDefaultWeight(UserWordWeightOption option) {
     switch (option) {
      case WordWeightMin:
        user_word_default_weight_ = min_weight_;
@@ -280,7 +892,7 @@ class DictTrie {
     }
   }
 
-  double CalcFreqSum(const vector<DictUnit>& node_infos) const {
+  double CalcFreqSum(const FlatArray<DictUnit>& node_infos) const {
     double sum = 0.0;
     for (size_t i = 0; i < node_infos.size(); i++) {
       sum += node_infos[i].weight;
@@ -288,29 +900,41 @@ class DictTrie {
     return sum;
   }
 
-  void CalculateWeight(vector<DictUnit>& node_infos, double sum) const {
+  void CalculateWeight(FlatArray<DictUnit>& node_infos, double sum) const {
     assert(sum > 0.0);
     for (size_t i = 0; i < node_infos.size(); i++) {
       DictUnit& node_info = node_infos[i];
       assert(node_info.weight > 0.0);
-      node_info.weight = log(double(node_info.weight)/sum);
+      node_info.weight = float(log(double(node_info.weight)/sum));
     }
   }
 
-  void Shrink(vector<DictUnit>& units) const {
-    vector<DictUnit>(units.begin(), units.end()).swap(units);
+  template <class T>
+  void Shrink(FlatArray<T>& array) const {
+    if (array.IsOwner()) {
+      array.shrink(array.size());
+    }
   }
 
-  vector<DictUnit> static_node_infos_;
-  deque<DictUnit> active_node_infos_; // must not be vector
-  Trie * trie_;
+  const DictTrie* base_; // of an overlay, NULL otherwise
+  uint16_t tag_base_; // the tag of a unit tells whether it belongs to the overlay or to base_
+  FlatArray<DictUnit> static_node_infos_;
+  deque<DictUnit> active_node_infos_; // must not be vector, the tries point into it
+  FlatArray<Rune> runes_; // the words of all the units
+  deque<string> tags_;
+  unordered_map<string, uint16_t> tag_ids_;
+  RcuPointer<Version> version_;
+  DagBuildOption dag_build_opt_;
+  StorageOption storage_opt_;
+  mutable mutex write_mutex_; // serializes the user word updates
+  FileUtil::MappedFile_c image_file_;
 
   double freq_sum_;
   double min_weight_;
   double max_weight_;
   double median_weight_;
   double user_word_default_weight_;
-  unordered_set<Rune> user_dict_single_chinese_word_;
+  unordered_set<Rune> user_dict_single_chinese_word_; // the versions get a copy
 };
 }
 
@@ -0,0 +1,38 @@
+#ifndef CPPJIEBA_EMBEDDED_DICT_HPP
+#define CPPJIEBA_EMBEDDED_DICT_HPP
+
+#include <stddef.h>
+#include "ParallelParser.hpp"
+
+namespace cppjieba {
+
+// A file compiled into the binary, it lives in read-only data, so processes
+// running the same binary share its pages.
+struct EmbeddedFile {
+  const unsigned char* data;
+  size_t size;
+
+  TextSpan Text() const {
+    const char* text = reinterpret_cast<const char*>(data);
+    return TextSpan(text, text + size);
+  }
+}; // struct EmbeddedFile
+
+// The default dictionary, HMM model, IDF table and stop words, generated at
+// build time by the jieba::embedded library of the CPPJIEBA_EMBED_DICT CMake
+// option, which has to be linked. The dictionary and the model are images
+// used in place, startup does not read or parse them:
+//
+//   DictTrie dict(EMBEDDED_DICT_IMAGE.data, EMBEDDED_DICT_IMAGE.size);
+//   HMMModel model(EMBEDDED_HMM_IMAGE.data, EMBEDDED_HMM_IMAGE.size);
+//   Jieba jieba(&dict, &model, EMBEDDED_IDF.Text(), EMBEDDED_STOP_WORDS.Text());
+//
+// The images are native endian, the build machine must match the target.
+extern const EmbeddedFile EMBEDDED_DICT_IMAGE;
+extern const EmbeddedFile EMBEDDED_HMM_IMAGE;
+extern const EmbeddedFile EMBEDDED_IDF;
+extern const EmbeddedFile EMBEDDED_STOP_WORDS;
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_EMBEDDED_DICT_HPP
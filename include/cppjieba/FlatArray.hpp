@@ -0,0 +1,124 @@
+#ifndef CPPJIEBA_FLAT_ARRAY_HPP
+#define CPPJIEBA_FLAT_ARRAY_HPP
+
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <stddef.h>
+
+namespace cppjieba {
+
+using namespace std;
+
+// A contiguous array of PODs that either owns its storage or views memory it
+// does not own, e.g. a section of a mapped dictionary image. Reads go through
+// the view, writes require owned storage, call Detach() first. Owned storage
+// is a single block from Alloc, so releasing it is a single deallocation.
+template <class T, class Alloc = std::allocator<T> >
+class FlatArray {
+ public:
+  typedef const T* const_iterator;
+
+  FlatArray(): data_(NULL), size_(0) {
+  }
+  FlatArray(const FlatArray& other): data_(NULL), size_(0) {
+    *this = other;
+  }
+  FlatArray& operator = (const FlatArray& other) {
+    if (this == &other) {
+      return *this;
+    }
+    if (other.IsOwner()) {
+      own_ = other.own_;
+      Sync();
+    } else {
+      Map(other.data_, other.size_);
+    }
+    return *this;
+  }
+
+  const T& operator [] (size_t i) const {
+    assert(i < size_);
+    return data_[i];
+  }
+  T& operator [] (size_t i) {
+    assert(IsOwner() && i < size_);
+    return own_[i];
+  }
+
+  const_iterator begin() const {
+    return data_;
+  }
+  const_iterator end() const {
+    return data_ + size_;
+  }
+  const T* data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return 0 == size_;
+  }
+
+  // views external memory, it must outlive the array or its next Detach()
+  void Map(const T* data, size_t size) {
+    vector<T, Alloc>().swap(own_);
+    data_ = data;
+    size_ = size;
+  }
+  bool IsOwner() const {
+    return data_ == own_.data();
+  }
+  void Detach() {
+    if (!IsOwner()) {
+      own_.assign(data_, data_ + size_);
+      Sync();
+    }
+  }
+
+  void assign(size_t size, const T& value) {
+    own_.assign(size, value);
+    Sync();
+  }
+  void resize(size_t size) {
+    Detach();
+    own_.resize(size);
+    Sync();
+  }
+  void reserve(size_t size) {
+    Detach();
+    own_.reserve(size);
+    Sync();
+  }
+  void push_back(const T& value) {
+    Detach();
+    own_.push_back(value);
+    Sync();
+  }
+  void insert(size_t pos, const T& value) {
+    Detach();
+    own_.insert(own_.begin() + pos, value);
+    Sync();
+  }
+  void shrink(size_t size) {
+    Detach();
+    vector<T, Alloc>(own_.begin(), own_.begin() + size).swap(own_);
+    Sync();
+  }
+
+ private:
+  void Sync() {
+    data_ = own_.data();
+    size_ = own_.size();
+  }
+
+  vector<T, Alloc> own_;
+  const T* data_;
+  size_t size_;
+}; // class FlatArray
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_FLAT_ARRAY_HPP
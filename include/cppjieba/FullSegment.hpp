@@ -51,6 +51,17 @@ class FullSegment: public SegmentBase {
         RuneStrArray::const_iterator end, 
         vector<WordRange>& res,
          CutContext * pCtx = nullptr) const {
+    assert(dictTrie_);
+    DagLattice latticeLocal;
+    DagLattice & lattice = pCtx ? pCtx->lattice : latticeLocal;
+    dictTrie_->Find(begin, end, lattice);
+    CutByLattice(begin, lattice, res);
+  }
+
+  // the same on the DAG of [begin, begin + lattice.size()) built already
+  void CutByLattice(RuneStrArray::const_iterator begin,
+        const DagLattice& lattice,
+        vector<WordRange>& res) const {
     // max index of res's words
     size_t maxIdx = 0;
 
@@ -59,24 +70,20 @@ class FullSegment: public SegmentBase {
 
     // tmp variables
     size_t wordLen = 0;
-    assert(dictTrie_);
-    vector<Dag> dagsLocal;
-    vector<Dag> & dags = pCtx ? pCtx->dags : dagsLocal;
-	dags.resize(0);
-    dictTrie_->Find(begin, end, dags);
-    for (size_t i = 0; i < dags.size(); i++) {
-      for (size_t j = 0; j < dags[i].nexts.size(); j++) {
-        size_t nextoffset = dags[i].nexts[j].first;
-        assert(nextoffset < dags.size());
-        const DictUnit* du = dags[i].nexts[j].second;
+    for (size_t i = 0; i < lattice.size(); i++) {
+      size_t edgeCount = lattice.EdgeCount(i);
+      for (const DagEdge* edge = lattice.EdgesBegin(i); edge != lattice.EdgesEnd(i); edge++) {
+        size_t nextoffset = edge->end;
+        assert(nextoffset < lattice.size());
+        const DictUnit* du = edge->unit;
         if (du == NULL) {
-          if (dags[i].nexts.size() == 1 && maxIdx <= uIdx) {
+          if (edgeCount == 1 && maxIdx <= uIdx) {
             WordRange wr(begin + i, begin + nextoffset);
             res.push_back(wr);
           }
         } else {
-          wordLen = du->word.size();
-          if (wordLen >= 2 || (dags[i].nexts.size() == 1 && maxIdx <= uIdx)) {
+          wordLen = du->wordLength;
+          if (wordLen >= 2 || (edgeCount == 1 && maxIdx <= uIdx)) {
             WordRange wr(begin + i, begin + nextoffset);
             res.push_back(wr);
           }
@@ -1,14 +1,21 @@
 #ifndef CPPJIEBA_HMMMODEL_H
 #define CPPJIEBA_HMMMODEL_H
 
+#include <map>
 #include "limonp/StringUtil.hpp"
 #include "Trie.hpp"
+#include "BinaryImage.hpp"
+#include "reader.h"
+#include "ParallelParser.hpp"
 
 namespace cppjieba {
 
 using namespace limonp;
 typedef unordered_map<Rune, double> EmitProbMap;
 
+const char* const HMM_IMAGE_MAGIC = "JIEBAHMM";
+const uint32_t HMM_IMAGE_VERSION = 2;
+
 struct HMMModel {
   /*
    * STATUS:
@@ -16,6 +23,18 @@ struct HMMModel {
    * */
   enum {B = 0, E = 1, M = 2, S = 3, STATUS_SUM = 4};
 
+  // Emission probabilities of one rune for all the states, MIN_DOUBLE for
+  // the unknown ones. 32 bytes, a row is read with a single cache line.
+  struct EmitProbRow {
+    double prob[STATUS_SUM];
+  }; // struct EmitProbRow
+
+  struct ImageMeta {
+    double startProb[STATUS_SUM];
+    double transProb[STATUS_SUM][STATUS_SUM];
+  }; // struct ImageMeta
+
+  // modelPath is either a text model or an image written by SaveImage()
   HMMModel(const string& modelPath) {
     memset(startProb, 0, sizeof(startProb));
     memset(transProb, 0, sizeof(transProb));
@@ -23,55 +42,166 @@ struct HMMModel {
     statMap[1] = 'E';
     statMap[2] = 'M';
     statMap[3] = 'S';
-    emitProbVec.push_back(&emitProbB);
-    emitProbVec.push_back(&emitProbE);
-    emitProbVec.push_back(&emitProbM);
-    emitProbVec.push_back(&emitProbS);
-    LoadModel(modelPath);
+    fill(unknownEmitProbs, unknownEmitProbs + STATUS_SUM, MIN_DOUBLE);
+    if (BinaryImageReader::FileHasMagic(modelPath, HMM_IMAGE_MAGIC)) {
+      LoadImage(modelPath);
+    } else {
+      LoadModel(modelPath);
+    }
+  }
+  // The model held in memory, e.g. in a storage blob or compiled into the
+  // binary. An image written by SaveImage() is used in place like a mapped
+  // one and must outlive the model. A text model is parsed straight from the
+  // memory and is not needed afterwards.
+  HMMModel(const void* data, size_t size) {
+    memset(startProb, 0, sizeof(startProb));
+    memset(transProb, 0, sizeof(transProb));
+    statMap[0] = 'B';
+    statMap[1] = 'E';
+    statMap[2] = 'M';
+    statMap[3] = 'S';
+    fill(unknownEmitProbs, unknownEmitProbs + STATUS_SUM, MIN_DOUBLE);
+    if (BinaryImageReader::HasMagic(data, size, HMM_IMAGE_MAGIC)) {
+      LoadImage(data, size, "memory image");
+    } else {
+      const char* text = static_cast<const char*>(data);
+      LoadModel(TextSpan(text, text + size), "memory model");
+    }
   }
   ~HMMModel() {
   }
-  void LoadModel(const string& filePath) {
-    ifstream ifile(filePath.c_str());
-    XCHECK(ifile.is_open()) << "open " << filePath << " failed";
-    string line;
-    vector<string> tmp;
-    vector<string> tmp2;
-    //Load startProb
-    XCHECK(GetLine(ifile, line));
-    Split(line, tmp, " ");
-    XCHECK(tmp.size() == STATUS_SUM);
-    for (size_t j = 0; j< tmp.size(); j++) {
-      startProb[j] = atof(tmp[j].c_str());
+
+  void LoadImage(const string& imagePath) {
+    XCHECK(imageFile.Open(imagePath)) << "open " << imagePath << " failed";
+    LoadImage(imageFile.GetData(), imageFile.GetSize(), imagePath);
+  }
+
+  // The emission table is used in place from the image, so processes mapping
+  // the same image share its pages.
+  void LoadImage(const void* data, size_t size, const string& imagePath) {
+    BinaryImageReader image;
+    XCHECK(image.Open(data, size, HMM_IMAGE_MAGIC, HMM_IMAGE_VERSION, ImageSectionNum))
+      << imagePath << " is not a hmm model image of version " << HMM_IMAGE_VERSION;
+    size_t count = 0;
+    const ImageMeta* meta = image.GetSection<ImageMeta>(ImageMetaSection, count);
+    XCHECK(meta && 1 == count) << "broken hmm model image " << imagePath;
+    memcpy(startProb, meta->startProb, sizeof(startProb));
+    memcpy(transProb, meta->transProb, sizeof(transProb));
+
+    const EmitProbRow* rows = image.GetSection<EmitProbRow>(ImageRowsSection, count);
+    XCHECK(rows) << "broken hmm model image " << imagePath;
+    emitProbRows.Map(rows, count);
+    const Rune* runes = image.GetSection<Rune>(ImageRunesSection, count);
+    XCHECK(runes && emitProbRows.size() == count) << "broken hmm model image " << imagePath;
+    emitProbRunes.Map(runes, count);
+    const uint8_t* masks = image.GetSection<uint8_t>(ImageMasksSection, count);
+    XCHECK(masks && emitProbRows.size() == count) << "broken hmm model image " << imagePath;
+    emitProbMasks.Map(masks, count);
+    const uint32_t* index = image.GetSection<uint32_t>(ImageIndexSection, count);
+    XCHECK(index && EMIT_INDEX_SIZE == count) << "broken hmm model image " << imagePath;
+    for (size_t i = 0; i < count; i++) {
+      XCHECK(index[i] <= emitProbRows.size()) << "broken hmm model image " << imagePath;
     }
+    emitProbIndex.Map(index, count);
+  }
 
-    //Load transProb
-    for (size_t i = 0; i < STATUS_SUM; i++) {
-      XCHECK(GetLine(ifile, line));
-      Split(line, tmp, " ");
-      XCHECK(tmp.size() == STATUS_SUM);
-      for (size_t j =0; j < STATUS_SUM; j++) {
-        transProb[i][j] = atof(tmp[j].c_str());
-      }
+  bool SaveImage(const string& imagePath) const {
+    ImageMeta meta;
+    memcpy(meta.startProb, startProb, sizeof(startProb));
+    memcpy(meta.transProb, transProb, sizeof(transProb));
+    BinaryImageWriter writer(HMM_IMAGE_MAGIC, HMM_IMAGE_VERSION, ImageSectionNum);
+    writer.SetSection(ImageMetaSection, &meta, 1);
+    writer.SetSection(ImageRowsSection, emitProbRows.data(), emitProbRows.size());
+    writer.SetSection(ImageIndexSection, emitProbIndex.data(), emitProbIndex.size());
+    writer.SetSection(ImageRunesSection, emitProbRunes.data(), emitProbRunes.size());
+    writer.SetSection(ImageMasksSection, emitProbMasks.data(), emitProbMasks.size());
+    if (!writer.Write(imagePath)) {
+      XLOG(ERROR) << "write " << imagePath << " failed.";
+      return false;
     }
+    return true;
+  }
+
+  void LoadModel(const string& filePath) {
+    FileUtil::MappedFile_c file;
+    XCHECK(file.Open(filePath)) << "open " << filePath << " failed";
+    const char* data = reinterpret_cast<const char*>(file.GetData());
+    LoadModel(TextSpan(data, data + file.GetSize()), filePath);
+  }
 
-    //Load emitProbB
-    XCHECK(GetLine(ifile, line));
-    XCHECK(LoadEmitProb(line, emitProbB));
+  // The emission lines hold nearly all of the model, the four of them are
+  // parsed in parallel.
+  void LoadModel(const TextSpan& text, const string& filePath) {
+    const char* cursor = text.begin;
+    const char* end = text.end;
+    vector<TextSpan> lines;
+    TextSpan line;
+    while (NextLine(cursor, end, line)) {
+      line = TrimSpan(line);
+      if (!line.empty() && '#' != *line.begin) {
+        lines.push_back(line);
+      }
+    }
+    XCHECK(lines.size() >= 1 + 2 * STATUS_SUM) << filePath << " is not a hmm model";
 
-    //Load emitProbE
-    XCHECK(GetLine(ifile, line));
-    XCHECK(LoadEmitProb(line, emitProbE));
+    //Load startProb
+    XCHECK(LoadProbs(lines[0], startProb));
 
-    //Load emitProbM
-    XCHECK(GetLine(ifile, line));
-    XCHECK(LoadEmitProb(line, emitProbM));
+    //Load transProb
+    for (size_t i = 0; i < STATUS_SUM; i++) {
+      XCHECK(LoadProbs(lines[1 + i], transProb[i]));
+    }
 
-    //Load emitProbS
-    XCHECK(GetLine(ifile, line));
-    XCHECK(LoadEmitProb(line, emitProbS));
+    //Load emitProb of B, E, M, S
+    vector<TextSpan> emitLines(lines.begin() + 1 + STATUS_SUM, lines.begin() + 1 + 2 * STATUS_SUM);
+    vector<vector<pair<Rune, double> > > emits(STATUS_SUM);
+    bool loaded[STATUS_SUM];
+    ParseChunksInParallel(emitLines, [this, &emits, &loaded](size_t y, const TextSpan& span) {
+      loaded[y] = LoadEmitProb(span, emits[y]);
+    });
+    // rune -> the mask of its known states and the row
+    map<Rune, pair<uint8_t, EmitProbRow> > rows;
+    for (size_t y = 0; y < STATUS_SUM; y++) {
+      XCHECK(loaded[y]);
+      for (size_t i = 0; i < emits[y].size(); i++) {
+        pair<uint8_t, EmitProbRow>& row = rows[emits[y][i].first];
+        if (0 == row.first) {
+          fill(row.second.prob, row.second.prob + STATUS_SUM, MIN_DOUBLE);
+        }
+        row.first |= uint8_t(1u << y);
+        row.second.prob[y] = emits[y][i].second;
+      }
+    }
+    CreateEmitTable(rows);
+  }
+  void GetMemoryStats(MemoryStats& stats) const {
+    stats.Add("emit_prob_rows", emitProbRows.size(), emitProbRows.size() * sizeof(EmitProbRow), !emitProbRows.IsOwner());
+    stats.Add("emit_prob_index", emitProbIndex.size(), emitProbIndex.size() * sizeof(uint32_t), !emitProbIndex.IsOwner());
+    stats.Add("emit_prob_runes", emitProbRunes.size(), emitProbRunes.size() * sizeof(Rune), !emitProbRunes.IsOwner());
+    stats.Add("emit_prob_masks", emitProbMasks.size(), emitProbMasks.size(), !emitProbMasks.IsOwner());
+    stats.Add("start_trans_prob", STATUS_SUM + STATUS_SUM * STATUS_SUM, sizeof(startProb) + sizeof(transProb));
+  }
+  inline double GetEmitProb(size_t status, Rune key,
+        double defVal)const {
+    size_t row = FindEmitProbRow(key);
+    if (NO_EMIT_PROB_ROW == row || !(emitProbMasks[row] & (1u << status))) {
+      return defVal;
+    }
+    return emitProbRows[row].prob[status];
+  }
+  // The emission probabilities of one state as a map, as the emitProbB/E/M/S
+  // members of the model used to hold them. A copy, to ease migrating.
+  EmitProbMap GetEmitProbMap(size_t status) const {
+    EmitProbMap mp;
+    for (size_t i = 0; i < emitProbRows.size(); i++) {
+      if (emitProbMasks[i] & (1u << status)) {
+        mp[emitProbRunes[i]] = emitProbRows[i].prob[status];
+      }
+    }
+    return mp;
   }
-  inline double GetEmitProb(const EmitProbMap* ptMp, Rune key, 
+  [[deprecated("the model keeps no maps, use GetEmitProb(status, key, defVal)")]]
+  inline double GetEmitProb(const EmitProbMap* ptMp, Rune key,
         double defVal)const {
     EmitProbMap::const_iterator cit = ptMp->find(key);
     if (cit == ptMp->end()) {
@@ -79,49 +209,103 @@ struct HMMModel {
     }
     return cit->second;
   }
-  bool GetLine(ifstream& ifile, string& line) {
-    while (getline(ifile, line)) {
-      Trim(line);
-      if (line.empty()) {
-        continue;
-      }
-      if (StartsWith(line, "#")) {
-        continue;
+  // The probabilities of key for all the states, MIN_DOUBLE for the unknown
+  // ones, one lookup instead of one per state.
+  const double* GetEmitProbs(Rune key) const {
+    size_t row = FindEmitProbRow(key);
+    return NO_EMIT_PROB_ROW == row ? unknownEmitProbs : emitProbRows[row].prob;
+  }
+  // the index of the row of key, NO_EMIT_PROB_ROW if there is none
+  size_t FindEmitProbRow(Rune key) const {
+    if (key < EMIT_INDEX_SIZE) {
+      uint32_t row = emitProbIndex[key];
+      return row ? row - 1 : NO_EMIT_PROB_ROW;
+    }
+    const Rune* it = lower_bound(emitProbRunes.begin(), emitProbRunes.end(), key);
+    if (it == emitProbRunes.end() || *it != key) {
+      return NO_EMIT_PROB_ROW;
+    }
+    return it - emitProbRunes.begin();
+  }
+  bool LoadProbs(const TextSpan& line, double* probs) const {
+    TextSpan fields[STATUS_SUM];
+    if (STATUS_SUM != SplitSpan(line, ' ', fields, STATUS_SUM)) {
+      return false;
+    }
+    for (size_t j = 0; j < STATUS_SUM; j++) {
+      if (!ParseDouble(fields[j], probs[j])) {
+        return false;
       }
-      return true;
     }
-    return false;
+    return true;
   }
-  bool LoadEmitProb(const string& line, EmitProbMap& mp) {
+  bool LoadEmitProb(const TextSpan& line, vector<pair<Rune, double> >& probs) const {
     if (line.empty()) {
       return false;
     }
-    vector<string> tmp, tmp2;
-    Unicode unicode;
-    Split(line, tmp, ",");
-    for (size_t i = 0; i < tmp.size(); i++) {
-      Split(tmp[i], tmp2, ":");
-      if (2 != tmp2.size()) {
+    TextSpan item;
+    TextSpan fields[2];
+    for (const char* p = line.begin; p < line.end; p = item.end + 1) {
+      const char* comma = static_cast<const char*>(memchr(p, ',', line.end - p));
+      item = TextSpan(p, NULL == comma ? line.end : comma);
+      if (item.empty()) {
+        continue;
+      }
+      if (2 != SplitSpan(item, ':', fields, 2)) {
         XLOG(ERROR) << "emitProb illegal.";
         return false;
       }
-      if (!DecodeRunesInString(tmp2[0], unicode) || unicode.size() != 1) {
+      RuneStrLite rp = DecodeRuneInString(fields[0].begin, fields[0].size());
+      double prob = 0.0;
+      if (0 == rp.len || rp.len != fields[0].size()) {
         XLOG(ERROR) << "TransCode failed.";
         return false;
       }
-      mp[unicode[0]] = atof(tmp2[1].c_str());
+      if (!ParseDouble(fields[1], prob)) {
+        XLOG(ERROR) << "emitProb illegal.";
+        return false;
+      }
+      probs.push_back(make_pair(Rune(rp.rune), prob));
     }
     return true;
   }
+  // rows are sorted by rune, BMP runes are found through a direct index
+  void CreateEmitTable(const map<Rune, pair<uint8_t, EmitProbRow> >& rows) {
+    emitProbRows.assign(rows.size(), EmitProbRow());
+    emitProbRunes.assign(rows.size(), 0);
+    emitProbMasks.assign(rows.size(), 0);
+    emitProbIndex.assign(EMIT_INDEX_SIZE, 0);
+    size_t i = 0;
+    for (map<Rune, pair<uint8_t, EmitProbRow> >::const_iterator it = rows.begin(); it != rows.end(); ++it, ++i) {
+      emitProbRows[i] = it->second.second;
+      emitProbRunes[i] = it->first;
+      emitProbMasks[i] = it->second.first;
+      if (it->first < EMIT_INDEX_SIZE) {
+        emitProbIndex[it->first] = uint32_t(i + 1);
+      }
+    }
+  }
+
+  enum ImageSectionId {
+    ImageMetaSection,
+    ImageRowsSection,
+    ImageIndexSection,
+    ImageRunesSection,
+    ImageMasksSection,
+    ImageSectionNum,
+  }; // enum ImageSectionId
+  static const size_t EMIT_INDEX_SIZE = 0x10000;
+  static const size_t NO_EMIT_PROB_ROW = size_t(-1);
 
   char statMap[STATUS_SUM];
   double startProb[STATUS_SUM];
   double transProb[STATUS_SUM][STATUS_SUM];
-  EmitProbMap emitProbB;
-  EmitProbMap emitProbE;
-  EmitProbMap emitProbM;
-  EmitProbMap emitProbS;
-  vector<EmitProbMap* > emitProbVec;
+  FlatArray<EmitProbRow> emitProbRows;
+  FlatArray<uint32_t> emitProbIndex; // BMP rune -> row + 1, 0 - unknown
+  FlatArray<Rune> emitProbRunes;      // the rune of each row
+  FlatArray<uint8_t> emitProbMasks;   // bit y is set if the prob of state y is known
+  double unknownEmitProbs[STATUS_SUM];
+  FileUtil::MappedFile_c imageFile;
 }; // struct HMMModel
 
 } // namespace cppjieba
@@ -131,66 +131,89 @@ class HMMSegment: public SegmentBase {
     }
   }
 
+  // Only the scores of the previous rune are kept, the backpointers take a
+  // byte per state and rune, STATUS_SUM of them side by side.
   void Viterbi(RuneStrArray::const_iterator begin, 
         RuneStrArray::const_iterator end, 
         vector<size_t>& status, CutContext * pCtx = nullptr ) const {
-    size_t Y = HMMModel::STATUS_SUM;
+    const size_t Y = HMMModel::STATUS_SUM;
     size_t X = end - begin;
 
-    size_t XYSize = X * Y;
-    size_t now, old, stat;
-    double tmp, endE, endS;
+    vector<uint8_t> localPath;
+    vector<uint8_t> & path = pCtx ? pCtx->path : localPath;
+    path.resize(X * Y);
 
-    vector<int> localPath;
-    vector<double> localWeight;
-
-    vector<int> & path = pCtx ? pCtx->path : localPath;
-    vector<double> & weight = pCtx ? pCtx->weight : localWeight;
-
-    path.resize(XYSize);
-    weight.resize(XYSize);
+    double weights[2][Y];
+    double* prev = weights[0];
+    double* cur = weights[1];
 
     //start
+    const double* emitProbs = model_->GetEmitProbs(begin->rune);
     for (size_t y = 0; y < Y; y++) {
-      weight[0 + y * X] = model_->startProb[y] + model_->GetEmitProb(model_->emitProbVec[y], begin->rune, MIN_DOUBLE);
-      path[0 + y * X] = -1;
+      prev[y] = model_->startProb[y] + emitProbs[y];
     }
 
-    double emitProb;
-
     for (size_t x = 1; x < X; x++) {
-      for (size_t y = 0; y < Y; y++) {
-        now = x + y*X;
-        weight[now] = MIN_DOUBLE;
-        path[now] = HMMModel::E; // warning
-        emitProb = model_->GetEmitProb(model_->emitProbVec[y], (begin+x)->rune, MIN_DOUBLE);
-        for (size_t preY = 0; preY < Y; preY++) {
-          old = x - 1 + preY * X;
-          tmp = weight[old] + model_->transProb[preY][y] + emitProb;
-          if (tmp > weight[now]) {
-            weight[now] = tmp;
-            path[now] = preY;
-          }
-        }
-      }
-    }
-
-    endE = weight[X-1+HMMModel::E*X];
-    endS = weight[X-1+HMMModel::S*X];
-    stat = 0;
-    if (endE >= endS) {
-      stat = HMMModel::E;
-    } else {
-      stat = HMMModel::S;
+      ViterbiStep(prev, model_->GetEmitProbs((begin+x)->rune), cur, &path[x * Y]);
+      std::swap(prev, cur);
     }
 
+    size_t stat = prev[HMMModel::E] >= prev[HMMModel::S] ? HMMModel::E : HMMModel::S;
     status.resize(X);
-    for (int x = X -1 ; x >= 0; x--) {
+    for (size_t x = X; x-- > 0;) {
       status[x] = stat;
-      stat = path[x + stat*X];
+      stat = path[x * Y + stat];
     }
   }
 
+  // The scores and the backpointers of all the states of a rune at once from
+  // the scores of the previous rune, in the order of the plain 4x4 loop.
+  void ViterbiStep(const double* prev, const double* emitProbs, double* cur, uint8_t* back) const {
+#ifdef CPPJIEBA_HAVE_SSE2
+    // lanes B, E and M, S
+    const __m128d emitLo = _mm_loadu_pd(emitProbs);
+    const __m128d emitHi = _mm_loadu_pd(emitProbs + 2);
+    __m128d bestLo = _mm_set1_pd(MIN_DOUBLE);
+    __m128d bestHi = bestLo;
+    __m128d argLo = _mm_set1_pd(HMMModel::E); // warning
+    __m128d argHi = argLo;
+    for (size_t preY = 0; preY < HMMModel::STATUS_SUM; preY++) {
+      const __m128d weight = _mm_set1_pd(prev[preY]);
+      const __m128d state = _mm_set1_pd(double(preY));
+      __m128d tmpLo = _mm_add_pd(_mm_add_pd(weight, _mm_loadu_pd(model_->transProb[preY])), emitLo);
+      __m128d tmpHi = _mm_add_pd(_mm_add_pd(weight, _mm_loadu_pd(model_->transProb[preY] + 2)), emitHi);
+      __m128d betterLo = _mm_cmpgt_pd(tmpLo, bestLo);
+      __m128d betterHi = _mm_cmpgt_pd(tmpHi, bestHi);
+      bestLo = _mm_max_pd(tmpLo, bestLo);
+      bestHi = _mm_max_pd(tmpHi, bestHi);
+      argLo = _mm_or_pd(_mm_and_pd(betterLo, state), _mm_andnot_pd(betterLo, argLo));
+      argHi = _mm_or_pd(_mm_and_pd(betterHi, state), _mm_andnot_pd(betterHi, argHi));
+    }
+    double args[HMMModel::STATUS_SUM];
+    _mm_storeu_pd(cur, bestLo);
+    _mm_storeu_pd(cur + 2, bestHi);
+    _mm_storeu_pd(args, argLo);
+    _mm_storeu_pd(args + 2, argHi);
+    for (size_t y = 0; y < HMMModel::STATUS_SUM; y++) {
+      back[y] = uint8_t(args[y]);
+    }
+#else
+    for (size_t y = 0; y < HMMModel::STATUS_SUM; y++) {
+      cur[y] = MIN_DOUBLE;
+      back[y] = HMMModel::E; // warning
+    }
+    for (size_t preY = 0; preY < HMMModel::STATUS_SUM; preY++) {
+      for (size_t y = 0; y < HMMModel::STATUS_SUM; y++) {
+        double tmp = prev[preY] + model_->transProb[preY][y] + emitProbs[y];
+        if (tmp > cur[y]) {
+          cur[y] = tmp;
+          back[y] = uint8_t(preY);
+        }
+      }
+    }
+#endif
+  }
+
   const HMMModel* model_;
   bool isNeedDestroy_;
 }; // class HMMSegment
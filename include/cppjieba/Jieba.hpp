@@ -3,9 +3,15 @@
 
 #include "QuerySegment.hpp"
 #include "KeywordExtractor.hpp"
+#include "StreamCutter.hpp"
+#include "ParallelParser.hpp"
 
 namespace cppjieba {
 
+// Smaller chunks of CutParallel() are not worth handing to a thread.
+const size_t MIN_PARALLEL_CUT_CHUNK_SIZE = 32 * 1024;
+const size_t PARALLEL_CUT_CHUNKS_PER_THREAD = 4;
+
 class Jieba {
  public:
   Jieba(const string& dict_path, 
@@ -13,16 +19,55 @@ class Jieba {
         const string& user_dict_path, 
         const string& idfPath, 
         const string& stopWordPath) 
-    : dict_trie_(dict_path, user_dict_path),
-      model_(model_path),
-      mp_seg_(&dict_trie_),
-      hmm_seg_(&model_),
-      mix_seg_(&dict_trie_, &model_),
-      full_seg_(&dict_trie_),
-      query_seg_(&dict_trie_, &model_),
-      extractor(&dict_trie_, &model_, idfPath, stopWordPath) {
+    : dict_trie_(new DictTrie(dict_path, user_dict_path)),
+      model_(new HMMModel(model_path)),
+      isNeedDestroy_(true),
+      mp_seg_(dict_trie_),
+      hmm_seg_(model_),
+      mix_seg_(dict_trie_, model_),
+      full_seg_(dict_trie_),
+      query_seg_(dict_trie_, model_),
+      extractor(dict_trie_, model_, idfPath, stopWordPath) {
+  }
+  // Shares the dictionary and the model with other instances, e.g. ones
+  // loaded from mapped images. They must outlive this instance, and user
+  // words inserted through any of the sharing instances are seen by all.
+  // Pass an overlay DictTrie to give an instance user words of its own.
+  Jieba(DictTrie* dictTrie,
+        const HMMModel* model,
+        const string& idfPath,
+        const string& stopWordPath)
+    : dict_trie_(dictTrie),
+      model_(model),
+      isNeedDestroy_(false),
+      mp_seg_(dict_trie_),
+      hmm_seg_(model_),
+      mix_seg_(dict_trie_, model_),
+      full_seg_(dict_trie_),
+      query_seg_(dict_trie_, model_),
+      extractor(dict_trie_, model_, idfPath, stopWordPath) {
+  }
+  // The same with the IDF table and the stop words as text in memory, e.g.
+  // the ones of EmbeddedDict.hpp.
+  Jieba(DictTrie* dictTrie,
+        const HMMModel* model,
+        const TextSpan& idfText,
+        const TextSpan& stopWordText)
+    : dict_trie_(dictTrie),
+      model_(model),
+      isNeedDestroy_(false),
+      mp_seg_(dict_trie_),
+      hmm_seg_(model_),
+      mix_seg_(dict_trie_, model_),
+      full_seg_(dict_trie_),
+      query_seg_(dict_trie_, model_),
+      extractor(dict_trie_, model_, idfText, stopWordText) {
   }
   ~Jieba() {
+    if (isNeedDestroy_) {
+      delete dict_trie_;
+      delete model_;
+    }
   }
 
   struct LocWord {
@@ -31,6 +76,18 @@ class Jieba {
     size_t end;
   }; // struct LocWord
 
+  // The cuts CutMultiple() makes at once.
+  enum CutMode {
+    CutModeMix = 1,    // Cut()
+    CutModeAll = 2,    // CutAll()
+    CutModeSearch = 4, // CutForSearch()
+  }; // enum CutMode
+
+  struct ModeWord {
+    Word word;
+    int modes; // the CutMode bits of the cuts giving the word
+  }; // struct ModeWord
+
   void Cut(const string& sentence, vector<string>& words, bool hmm = true) const {
     mix_seg_.Cut(sentence, words, hmm);
   }
@@ -40,6 +97,65 @@ class Jieba {
   void Cut(const std::string_view & sentence, vector<Word>& words, CutContext & ctx, bool hmm = true) const {
       mix_seg_.Cut(sentence, words, hmm, &ctx);
   }
+  // Cuts what is read from is chunk by chunk, see StreamCutter, words gets
+  // the words of each chunk. False on a read error.
+  bool CutStream(istream& is, const StreamCutter::WordsFunc& words, bool hmm = true) const {
+    CutContext ctx;
+    StreamCutter cutter(mix_seg_.GetSeparators(), [this, &ctx, hmm](const std::string_view& chunk, vector<Word>& res) {
+      mix_seg_.Cut(chunk, res, hmm, &ctx);
+    }, words);
+    return cutter.Cut(is);
+  }
+  // Cuts a long text on several threads, the words are those of Cut(). The
+  // text is split after separators into chunks, a few per thread so that
+  // the threads stay balanced, each thread with a CutContext of its own.
+  // threads 0 - one per hardware thread.
+  void CutParallel(const std::string_view& sentence, vector<Word>& words, bool hmm = true, size_t threads = 0) const {
+    if (0 == threads) {
+      threads = max<size_t>(1, thread::hardware_concurrency());
+    }
+    vector<TextSpan> chunks;
+    size_t chunkSize = max(MIN_PARALLEL_CUT_CHUNK_SIZE, sentence.size() / (threads * PARALLEL_CUT_CHUNKS_PER_THREAD) + 1);
+    SplitAtSeparators(sentence, chunkSize, chunks);
+    if (threads < 2 || chunks.size() < 2) {
+      mix_seg_.Cut(sentence, words, hmm);
+      return;
+    }
+    vector<vector<Word> > results(chunks.size());
+    vector<uint32_t> runes(chunks.size());
+    vector<CutContext> contexts(min(threads, chunks.size()));
+    RunInParallel(chunks.size(), threads, [&](size_t worker, size_t i) {
+      const TextSpan& chunk = chunks[i];
+      mix_seg_.Cut(std::string_view(chunk.begin, chunk.size()), results[i], hmm, &contexts[worker]);
+      uint32_t count = 0;
+      for (const char* p = chunk.begin; p < chunk.end; p++) {
+        count += (uint8_t(*p) & 0xc0) != 0x80;
+      }
+      runes[i] = count;
+    });
+
+    words.clear();
+    size_t total = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+      // only a chunk that is not UTF-8 has no words, Cut() of the whole text
+      // has none then either
+      if (results[i].empty()) {
+        return;
+      }
+      total += results[i].size();
+    }
+    words.reserve(total);
+    uint32_t offset = 0, unicodeOffset = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+      for (size_t j = 0; j < results[i].size(); j++) {
+        words.push_back(std::move(results[i][j]));
+        words.back().offset += offset;
+        words.back().unicode_offset += unicodeOffset;
+      }
+      offset += uint32_t(chunks[i].size());
+      unicodeOffset += runes[i];
+    }
+  }
   void CutAll(const string& sentence, vector<string>& words) const {
     full_seg_.Cut(sentence, words);
   }
@@ -52,6 +168,63 @@ class Jieba {
   void CutForSearch(const std::string_view & sentence, vector<Word>& words, CutContext & ctx, bool hmm = true) const {
     query_seg_.Cut(sentence, words, hmm, &ctx);
   }
+  // Makes the cuts of modes at once, the text is decoded and its DAG built
+  // a single time for all of them. words are in the order of their offset,
+  // then of their length, a word given by several cuts comes once with all
+  // their bits. The words with a bit are those of its cut, the ones of
+  // CutForSearch() in another order.
+  void CutMultiple(const std::string_view& sentence, vector<ModeWord>& words, int modes, CutContext& ctx, bool hmm = true) const {
+    PreFilter pre_filter(mix_seg_.GetSeparators(), sentence);
+    vector<pair<WordRange, int> > found;
+    found.reserve(sentence.size() / 2);
+    vector<WordRange>& res = ctx.mixRes;
+    vector<WordRange>& subWords = ctx.wrs;
+    while (pre_filter.HasNext()) {
+      PreFilter::Range range = pre_filter.Next();
+      const DagLattice& lattice = ctx.lattice;
+      dict_trie_->Find(range.begin, range.end, ctx.lattice);
+      if (modes & (CutModeMix | CutModeSearch)) {
+        res.resize(0);
+        mix_seg_.CutByLattice(range.begin, lattice, res, hmm, &ctx);
+        RuneStrArray::const_iterator begin = range.begin;
+        auto isWord = [&lattice, begin](const WordRange& wr) {
+          return NULL != lattice.FindEdge(wr.left - begin, wr.right - begin);
+        };
+        for (size_t i = 0; i < res.size(); i++) {
+          if (modes & CutModeSearch) {
+            subWords.resize(0);
+            QuerySegment::AddSubWords(res[i], subWords, isWord);
+            for (size_t j = 0; j < subWords.size(); j++) {
+              found.push_back(make_pair(subWords[j], int(CutModeSearch)));
+            }
+          }
+          found.push_back(make_pair(res[i], modes & (CutModeMix | CutModeSearch)));
+        }
+      }
+      if (modes & CutModeAll) {
+        res.resize(0);
+        full_seg_.CutByLattice(range.begin, lattice, res);
+        for (size_t i = 0; i < res.size(); i++) {
+          found.push_back(make_pair(res[i], int(CutModeAll)));
+        }
+      }
+    }
+
+    sort(found.begin(), found.end(), [](const pair<WordRange, int>& a, const pair<WordRange, int>& b) {
+      return a.first.left < b.first.left || (a.first.left == b.first.left && a.first.right < b.first.right);
+    });
+    words.clear();
+    words.reserve(found.size());
+    for (size_t i = 0; i < found.size(); i++) {
+      const WordRange& wr = found[i].first;
+      if (i > 0 && wr.left == found[i - 1].first.left && wr.right == found[i - 1].first.right) {
+        words.back().modes |= found[i].second;
+        continue;
+      }
+      ModeWord word = {GetWordFromRunes(sentence, wr.left, wr.right), found[i].second};
+      words.push_back(word);
+    }
+  }
   void CutHMM(const string& sentence, vector<string>& words) const {
     hmm_seg_.Cut(sentence, words);
   }
@@ -72,20 +245,20 @@ class Jieba {
     return mix_seg_.LookupTag(str);
   }
   bool InsertUserWord(const string& word, const string& tag = UNKNOWN_TAG) {
-    return dict_trie_.InsertUserWord(word, tag);
+    return dict_trie_->InsertUserWord(word, tag);
   }
 
   bool InsertUserWord(const string& word,int freq, const string& tag = UNKNOWN_TAG) {
-    return dict_trie_.InsertUserWord(word,freq, tag);
+    return dict_trie_->InsertUserWord(word,freq, tag);
   }
 
   bool DeleteUserWord(const string& word, const string& tag = UNKNOWN_TAG) {
-    return dict_trie_.DeleteUserWord(word, tag);
+    return dict_trie_->DeleteUserWord(word, tag);
   }
   
   bool Find(const string& word)
   {
-    return dict_trie_.Find(word);
+    return dict_trie_->Find(word);
   }
 
   void ResetSeparators(const string& s) {
@@ -97,29 +270,83 @@ class Jieba {
     query_seg_.ResetSeparators(s);
   }
 
+  // Shared dictionaries and models are counted in full by every sharer.
+  void GetMemoryStats(MemoryStats& stats) const {
+    MemoryStats part;
+    dict_trie_->GetMemoryStats(part);
+    stats.Merge("dict.", part);
+    part = MemoryStats();
+    model_->GetMemoryStats(part);
+    stats.Merge("hmm.", part);
+    part = MemoryStats();
+    extractor.GetMemoryStats(part);
+    stats.Merge("keyword.", part);
+  }
+
   const DictTrie* GetDictTrie() const {
-    return &dict_trie_;
+    return dict_trie_;
   } 
   
   const HMMModel* GetHMMModel() const {
-    return &model_;
+    return model_;
   }
 
   void LoadUserDict(const vector<string>& buf)  {
-    dict_trie_.LoadUserDict(buf);
+    dict_trie_->LoadUserDict(buf);
   }
 
   void LoadUserDict(const set<string>& buf)  {
-    dict_trie_.LoadUserDict(buf);
+    dict_trie_->LoadUserDict(buf);
   }
 
   void LoadUserDict(const string& path)  {
-    dict_trie_.LoadUserDict(path);
+    dict_trie_->LoadUserDict(path);
+  }
+
+  void LoadUserDict(const TextSpan& text)  {
+    dict_trie_->LoadUserDict(text);
+  }
+
+  // Loads on a thread of its own, cutting goes on with the words present
+  // until the new ones are swapped in. This instance must outlive the future.
+  future<void> LoadUserDictAsync(const string& path) {
+    return dict_trie_->LoadUserDictAsync(path);
+  }
+
+  future<void> LoadUserDictAsync(const vector<string>& buf) {
+    return dict_trie_->LoadUserDictAsync(buf);
   }
 
  private:
-  DictTrie dict_trie_;
-  HMMModel model_;
+  // Splits text into chunks of about chunkSize bytes that end after a
+  // separator, no word crosses them.
+  void SplitAtSeparators(const std::string_view& text, size_t chunkSize, vector<TextSpan>& chunks) const {
+    const SeparatorSet& separators = mix_seg_.GetSeparators();
+    const char* end = text.data() + text.size();
+    for (const char* begin = text.data(); begin < end;) {
+      const char* cut = size_t(end - begin) > chunkSize ? begin + chunkSize : end;
+      while (cut < end && 0x80 == (uint8_t(*cut) & 0xc0)) {
+        cut++;
+      }
+      while (cut < end) {
+        RuneStrLite rp = DecodeRuneInString(cut, end - cut);
+        if (0 == rp.len) {
+          cut = end; // not UTF-8, the cut of the chunk fails on it
+          break;
+        }
+        cut += rp.len;
+        if (separators.Contains(rp.rune)) {
+          break;
+        }
+      }
+      chunks.push_back(TextSpan(begin, cut));
+      begin = cut;
+    }
+  }
+
+  DictTrie* dict_trie_;
+  const HMMModel* model_;
+  bool isNeedDestroy_;
   
   // They share the same dict trie and model
   MPSegment mp_seg_;
@@ -36,9 +36,33 @@ class KeywordExtractor {
     LoadIdfDict(idfPath);
     LoadStopWordDict(stopWordPath);
   }
+  // the IDF table and the stop words are text in memory, e.g. compiled into
+  // the binary, they are not needed after construction
+  KeywordExtractor(const DictTrie* dictTrie, 
+        const HMMModel* model,
+        const TextSpan& idfText, 
+        const TextSpan& stopWordText) 
+    : segment_(dictTrie, model) {
+    LoadIdfDict(idfText);
+    LoadStopWordDict(stopWordText);
+  }
   ~KeywordExtractor() {
   }
 
+  // the IDF table and the stop words only, the segmenter is not included
+  void GetMemoryStats(MemoryStats& stats) const {
+    size_t bytes = HashTableBytes(idfMap_);
+    for (unordered_map<string, double>::const_iterator it = idfMap_.begin(); it != idfMap_.end(); ++it) {
+      bytes += HeapBytes(it->first);
+    }
+    stats.Add("idf", idfMap_.size(), bytes);
+    bytes = HashTableBytes(stopWords_);
+    for (unordered_set<string>::const_iterator it = stopWords_.begin(); it != stopWords_.end(); ++it) {
+      bytes += HeapBytes(*it);
+    }
+    stats.Add("stop_words", stopWords_.size(), bytes);
+  }
+
   void Extract(const string& sentence, vector<string>& keywords, size_t topN) const {
     vector<Word> topWords;
     Extract(sentence, topWords, topN);
@@ -91,56 +115,75 @@ class KeywordExtractor {
     partial_sort(keywords.begin(), keywords.begin() + topN, keywords.end(), Compare);
     keywords.resize(topN);
   }
- private:
+
+  // The loaders replace the IDF table or the stop words, e.g. on a reload,
+  // and must not run while extracting. The text versions parse straight from
+  // the memory, which is not needed afterwards.
   void LoadIdfDict(const string& idfPath) {
-    FileUtil::FileReader_c tReader;
-    bool bOpenOk = tReader.Open(idfPath);
-    XCHECK(bOpenOk) << "open " << idfPath << " failed.";
+    FileUtil::MappedFile_c file;
+    XCHECK(file.Open(idfPath)) << "open " << idfPath << " failed.";
+    const char* data = reinterpret_cast<const char*>(file.GetData());
+    LoadIdfDict(TextSpan(data, data + file.GetSize()));
+  }
 
-    double idf = 0.0;
+  // Lines are "word idf", parsed in parallel chunks and merged in text order.
+  void LoadIdfDict(const TextSpan& text) {
+    vector<TextSpan> spans;
+    SplitIntoLineChunks(text.begin, text.size(), spans);
+    vector<vector<pair<TextSpan, double> > > chunks(spans.size());
+    ParseChunksInParallel(spans, [&chunks](size_t i, const TextSpan& span) {
+      ParseIdfChunk(span, chunks[i]);
+    });
+
+    size_t count = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+      count += chunks[i].size();
+    }
+    idfMap_.clear();
+    idfMap_.reserve(count);
     double idfSum = 0.0;
-    size_t lineno = 0;
-
-    const int MAX_LINE_LEN = 1024;
-    char dBuffer[MAX_LINE_LEN];
-    char * dValues[DICT_COLUMN_NUM];
-
-    int iLen = 0;
-    while ( ( iLen = tReader.GetLine ( dBuffer, sizeof(dBuffer) ) )>=0 )
-    {
-      if ( !iLen )
-      {
-        XLOG(ERROR) << "lineno: " << lineno << " empty. skipped.";
-        continue;
+    for (size_t i = 0; i < chunks.size(); i++) {
+      for (size_t j = 0; j < chunks[i].size(); j++) {
+        idfMap_[chunks[i][j].first.str()] = chunks[i][j].second;
+        idfSum += chunks[i][j].second;
       }
-
-      if ( !SplitText ( dBuffer, iLen, dValues, 2 ) )
-      {
-        XLOG(ERROR) << "line: " << dBuffer << ", lineno: " << lineno << " empty. skipped.";
-        continue;
-      }
-
-      idf = atof(dValues[1]);
-      idfMap_[dValues[0]] = idf;
-      idfSum += idf;
-      lineno++;
     }
 
-    assert(lineno);
-    idfAverage_ = idfSum / lineno;
+    assert(count);
+    idfAverage_ = idfSum / count;
     assert(idfAverage_ > 0.0);
   }
 
   void LoadStopWordDict(const string& filePath) {
-    ifstream ifs(filePath.c_str());
-    XCHECK(ifs.is_open()) << "open " << filePath << " failed";
-    string line ;
-    while (getline(ifs, line)) {
-      stopWords_.insert(line);
+    FileUtil::MappedFile_c file;
+    XCHECK(file.Open(filePath)) << "open " << filePath << " failed";
+    const char* data = reinterpret_cast<const char*>(file.GetData());
+    LoadStopWordDict(TextSpan(data, data + file.GetSize()));
+  }
+
+  void LoadStopWordDict(const TextSpan& text) {
+    stopWords_.clear();
+    TextSpan line;
+    for (const char* cursor = text.begin; NextLine(cursor, text.end, line);) {
+      stopWords_.insert(line.str());
     }
     assert(stopWords_.size());
   }
 
+ private:
+  static void ParseIdfChunk(const TextSpan& text, vector<pair<TextSpan, double> >& entries) {
+    TextSpan line;
+    TextSpan fields[2];
+    for (const char* cursor = text.begin; NextLine(cursor, text.end, line);) {
+      double idf = 0.0;
+      if (2 != SplitSpan(line, ' ', fields, 2) || !ParseDouble(fields[1], idf)) {
+        XLOG(ERROR) << "line: " << line.str() << " illegal. skipped.";
+        continue;
+      }
+      entries.push_back(make_pair(fields[0], idf));
+    }
+  }
+
   static bool Compare(const Word& lhs, const Word& rhs) {
     return lhs.weight > rhs.weight;
   }
@@ -0,0 +1,82 @@
+#ifndef CPPJIEBA_LARGE_PAGE_ALLOCATOR_HPP
+#define CPPJIEBA_LARGE_PAGE_ALLOCATOR_HPP
+
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace cppjieba {
+
+// Allocates big blocks as anonymous mappings aligned to 2MB and asks the
+// kernel to back them with transparent huge pages, which takes most of the
+// TLB misses out of random trie walks. Small blocks and other platforms use
+// the regular heap. Whether huge pages are really used depends on the
+// transparent_hugepage setting of the host.
+template <class T>
+class LargePageAllocator {
+ public:
+  typedef T value_type;
+
+  LargePageAllocator() {
+  }
+  template <class U>
+  LargePageAllocator(const LargePageAllocator<U>&) {
+  }
+
+  T* allocate(size_t n) {
+    size_t bytes = n * sizeof(T);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (bytes >= LARGE_PAGE_SIZE) {
+      size_t size = RoundUp(bytes);
+      // over-map by one page so that the block can start on a page boundary
+      char* mapped = static_cast<char*>(mmap(NULL, size + LARGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+      if (mapped == MAP_FAILED) {
+        throw std::bad_alloc();
+      }
+      char* block = reinterpret_cast<char*>(RoundUp(reinterpret_cast<uintptr_t>(mapped)));
+      if (block != mapped) {
+        munmap(mapped, block - mapped);
+      }
+      munmap(block + size, mapped + LARGE_PAGE_SIZE - block);
+      madvise(block, size, MADV_HUGEPAGE);
+      return reinterpret_cast<T*>(block);
+    }
+#endif
+    return static_cast<T*>(::operator new(bytes));
+  }
+
+  void deallocate(T* p, size_t n) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    size_t bytes = n * sizeof(T);
+    if (bytes >= LARGE_PAGE_SIZE) {
+      munmap(p, RoundUp(bytes));
+      return;
+    }
+#endif
+    ::operator delete(p);
+  }
+
+ private:
+  static const size_t LARGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+  static size_t RoundUp(size_t size) {
+    return (size + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+  }
+}; // class LargePageAllocator
+
+template <class T, class U>
+inline bool operator == (const LargePageAllocator<T>&, const LargePageAllocator<U>&) {
+  return true;
+}
+
+template <class T, class U>
+inline bool operator != (const LargePageAllocator<T>&, const LargePageAllocator<U>&) {
+  return false;
+}
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_LARGE_PAGE_ALLOCATOR_HPP
@@ -58,15 +58,39 @@ class MPSegment: public SegmentTagged {
            vector<WordRange>& words,
            size_t max_word_len = MAX_WORD_LENGTH,
            CutContext * pCtx = nullptr) const {
-    vector<Dag> dagsLocal;
-    vector<Dag> & dags = pCtx ? pCtx->dags : dagsLocal;
-	dags.resize(0);
+    // the DP runs along the trie walk, no DAG is kept
+    vector<DagPath> pathsLocal;
+    vector<DagPath> & paths = pCtx ? pCtx->paths : pathsLocal;
+    paths.resize(end - begin);
+    PathFinder finder = {paths, dictTrie_->GetMinWeight()};
+    if (dictTrie_->FindBackwards(begin, end, max_word_len, finder)) {
+      CutByPaths(begin, paths, words);
+      return;
+    }
+
+    // the automaton finds the words by their end, it builds the DAG first
+    DagLattice latticeLocal;
+    DagLattice & lattice = pCtx ? pCtx->lattice : latticeLocal;
     dictTrie_->Find(begin, 
           end, 
-          dags,
+          lattice,
           max_word_len);
-    CalcDP(dags);
-    CutByDag(begin, end, dags, words);
+    CutByLattice(begin, lattice, words, pCtx);
+  }
+
+  // the same on the DAG of [begin, begin + lattice.size()) built already
+  void CutByLattice(RuneStrArray::const_iterator begin,
+           const DagLattice& lattice,
+           vector<WordRange>& words,
+           CutContext * pCtx = nullptr) const {
+    vector<DagPath> pathsLocal;
+    vector<DagPath> & paths = pCtx ? pCtx->paths : pathsLocal;
+    paths.resize(lattice.size());
+    PathFinder finder = {paths, dictTrie_->GetMinWeight()};
+    for (size_t i = lattice.size(); i-- > 0;) {
+      finder(i, lattice.EdgesBegin(i), lattice.EdgesEnd(i));
+    }
+    CutByPaths(begin, paths, words);
   }
 
   const DictTrie* GetDictTrie() const {
@@ -81,52 +105,48 @@ class MPSegment: public SegmentTagged {
     return dictTrie_->IsUserDictSingleChineseWord(value);
   }
  private:
-  void CalcDP(vector<Dag>& dags) const {
-    size_t nextPos;
-    const DictUnit* p;
-    double val;
-
-    for (vector<Dag>::reverse_iterator rit = dags.rbegin(); rit != dags.rend(); rit++) {
-      rit->pInfo = NULL;
-      rit->weight = MIN_DOUBLE;
-      assert(!rit->nexts.empty());
-      for (LocalVector<pair<size_t, const DictUnit*> >::const_iterator it = rit->nexts.begin(); it != rit->nexts.end(); it++) {
-        nextPos = it->first;
-        p = it->second;
-        val = 0.0;
-        if (nextPos + 1 < dags.size()) {
-          val += dags[nextPos + 1].weight;
+  // The DP for position i, over the edges [first, last) from there, the
+  // positions after it are done.
+  struct PathFinder {
+    vector<DagPath>& paths;
+    double minWeight;
+
+    void operator()(size_t i, const DagEdge* first, const DagEdge* last) const {
+      DagPath& path = paths[i];
+      path.pInfo = NULL;
+      path.weight = MIN_DOUBLE;
+      assert(first != last);
+      for (const DagEdge* it = first; it != last; it++) {
+        size_t nextPos = it->end;
+        const DictUnit* p = it->unit;
+        double val = 0.0;
+        if (nextPos + 1 < paths.size()) {
+          val += paths[nextPos + 1].weight;
         }
 
         if (p) {
           val += p->weight;
         } else {
-          val += dictTrie_->GetMinWeight();
+          val += minWeight;
         }
-        if (val > rit->weight) {
-          rit->pInfo = p;
-          rit->weight = val;
+        if (val > path.weight) {
+          path.pInfo = p;
+          path.weight = val;
         }
       }
     }
-  }
-  void CutByDag(RuneStrArray::const_iterator begin, 
-        RuneStrArray::const_iterator end, 
-        const vector<Dag>& dags, 
+  }; // struct PathFinder
+
+  void CutByPaths(RuneStrArray::const_iterator begin,
+        const vector<DagPath>& paths,
         vector<WordRange>& words) const {
     size_t i = 0;
-    while (i < dags.size()) {
-      const DictUnit* p = dags[i].pInfo;
-      if (p) {
-        assert(p->word.size() >= 1);
-        WordRange wr(begin + i, begin + i + p->word.size() - 1);
-        words.push_back(wr);
-        i += p->word.size();
-      } else { //single chinese word
-        WordRange wr(begin + i, begin + i);
-        words.push_back(wr);
-        i++;
-      }
+    while (i < paths.size()) {
+      const DictUnit* p = paths[i].pInfo;
+      size_t length = p ? p->wordLength : 1;
+      assert(length >= 1);
+      words.push_back(WordRange(begin + i, begin + i + length - 1));
+      i += length;
     }
   }
 
@@ -0,0 +1,98 @@
+#ifndef CPPJIEBA_MEMORY_STATS_HPP
+#define CPPJIEBA_MEMORY_STATS_HPP
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stddef.h>
+
+namespace cppjieba {
+
+using namespace std;
+
+// Memory held by one structure of a dictionary or a model. Mapped bytes live
+// in a mapped image, they are shared with the other processes mapping it.
+// Heap bytes of hash tables and strings are estimates, allocator overhead is
+// not included.
+struct MemoryUsage {
+  string name;
+  size_t elements;
+  size_t bytes;
+  bool mapped;
+}; // struct MemoryUsage
+
+struct MemoryStats {
+  vector<MemoryUsage> usages;
+  size_t trieStates;          // states in use
+  vector<size_t> trieDepths;  // trieDepths[d] - states d runes below the root
+
+  MemoryStats(): trieStates(0) {
+  }
+
+  void Add(const string& name, size_t elements, size_t bytes, bool mapped = false) {
+    MemoryUsage usage = {name, elements, bytes, mapped};
+    usages.push_back(usage);
+  }
+
+  // takes over the usages of other, their names get prefix
+  void Merge(const string& prefix, const MemoryStats& other) {
+    for (size_t i = 0; i < other.usages.size(); i++) {
+      MemoryUsage usage = other.usages[i];
+      usage.name = prefix + usage.name;
+      usages.push_back(usage);
+    }
+    trieStates += other.trieStates;
+    if (trieDepths.size() < other.trieDepths.size()) {
+      trieDepths.resize(other.trieDepths.size(), 0);
+    }
+    for (size_t i = 0; i < other.trieDepths.size(); i++) {
+      trieDepths[i] += other.trieDepths[i];
+    }
+  }
+
+  size_t TotalBytes(bool mapped) const {
+    size_t total = 0;
+    for (size_t i = 0; i < usages.size(); i++) {
+      if (usages[i].mapped == mapped) {
+        total += usages[i].bytes;
+      }
+    }
+    return total;
+  }
+
+  void AddDepth(size_t depth) {
+    if (trieDepths.size() <= depth) {
+      trieDepths.resize(depth + 1, 0);
+    }
+    trieDepths[depth]++;
+  }
+}; // struct MemoryStats
+
+// estimated heap bytes of a string, short ones are kept inside
+inline size_t HeapBytes(const string& s) {
+  return s.capacity() + 1 > sizeof(string) ? s.capacity() + 1 : 0;
+}
+
+// estimated bytes of a node based hash container, a node holds the value,
+// the next pointer and the cached hash
+template <class HashTable>
+size_t HashTableBytes(const HashTable& table) {
+  return table.bucket_count() * sizeof(void*) + table.size() * (sizeof(typename HashTable::value_type) + 2 * sizeof(void*));
+}
+
+inline ostream& operator << (ostream& os, const MemoryStats& stats) {
+  for (size_t i = 0; i < stats.usages.size(); i++) {
+    const MemoryUsage& usage = stats.usages[i];
+    os << usage.name << ": " << usage.elements << " elements, " << usage.bytes << " bytes" << (usage.mapped ? " mapped" : "") << "\n";
+  }
+  os << "heap: " << stats.TotalBytes(false) << " bytes, mapped: " << stats.TotalBytes(true) << " bytes\n";
+  os << "trie states: " << stats.trieStates << ", by depth:";
+  for (size_t i = 0; i < stats.trieDepths.size(); i++) {
+    os << " " << stats.trieDepths[i];
+  }
+  return os << "\n";
+}
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_MEMORY_STATS_HPP
@@ -61,10 +61,43 @@ class MixSegment: public SegmentTagged {
     words.reserve(end - begin);
     mpSeg_.Cut(begin, end, words, MAX_WORD_LENGTH, pCtx);
 
+    CutByHmm(words, res, pCtx);
+  }
+
+  // the same on the DAG of [begin, begin + lattice.size()) built already
+  void CutByLattice(RuneStrArray::const_iterator begin, const DagLattice& lattice, vector<WordRange>& res, bool hmm, CutContext * pCtx = nullptr) const {
+    if (!hmm) {
+      mpSeg_.CutByLattice(begin, lattice, res, pCtx);
+      return;
+    }
+
+    vector<WordRange> wordsLocal;
+    vector<WordRange> & words = pCtx ? pCtx->mixWords : wordsLocal;
+    words.resize(0);
+    words.reserve(lattice.size());
+    mpSeg_.CutByLattice(begin, lattice, words, pCtx);
+    CutByHmm(words, res, pCtx);
+  }
+
+  const DictTrie* GetDictTrie() const {
+    return mpSeg_.GetDictTrie();
+  }
+
+  bool Tag(const string& src, vector<pair<string, string> >& res) const {
+    return tagger_.Tag(src, res, *this);
+  }
+
+  string LookupTag(const string &str) const {
+    return tagger_.LookupTag(str, *this);
+  }
+
+ private:
+  // the runs of single runes the dictionary cut leaves are cut by the HMM
+  void CutByHmm(const vector<WordRange>& words, vector<WordRange>& res, CutContext * pCtx) const {
     vector<WordRange> hmmResLocal;
     vector<WordRange> & hmmRes = pCtx ? pCtx->hmmRes : hmmResLocal;
 	hmmRes.resize(0);
-    hmmRes.reserve(end - begin);
+    hmmRes.reserve(words.size());
     for (size_t i = 0; i < words.size(); i++) {
       //if mp Get a word, it's ok, put it into result
       if (words[i].left != words[i].right || (words[i].left == words[i].right && mpSeg_.IsUserDictSingleChineseWord(words[i].left->rune))) {
@@ -95,19 +128,6 @@ class MixSegment: public SegmentTagged {
     }
   }
 
-  const DictTrie* GetDictTrie() const {
-    return mpSeg_.GetDictTrie();
-  }
-
-  bool Tag(const string& src, vector<pair<string, string> >& res) const {
-    return tagger_.Tag(src, res, *this);
-  }
-
-  string LookupTag(const string &str) const {
-    return tagger_.LookupTag(str, *this);
-  }
-
- private:
   MPSegment mpSeg_;
   HMMSegment hmmSeg_;
   PosTagger tagger_;
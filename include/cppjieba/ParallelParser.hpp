@@ -0,0 +1,186 @@
+#ifndef CPPJIEBA_PARALLEL_PARSER_HPP
+#define CPPJIEBA_PARALLEL_PARSER_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include "Unicode.hpp"
+
+namespace cppjieba {
+
+using namespace std;
+
+// A piece of text in memory, e.g. of a mapped file, not NUL terminated.
+struct TextSpan {
+  const char* begin;
+  const char* end;
+
+  TextSpan(): begin(NULL), end(NULL) {
+  }
+  TextSpan(const char* b, const char* e): begin(b), end(e) {
+  }
+  size_t size() const {
+    return end - begin;
+  }
+  bool empty() const {
+    return begin == end;
+  }
+  string str() const {
+    return string(begin, end);
+  }
+}; // struct TextSpan
+
+// Smaller chunks are not worth a thread.
+const size_t MIN_PARSE_CHUNK_SIZE = 256 * 1024;
+
+// Cuts text into chunks of whole lines, one per hardware thread at most.
+inline void SplitIntoLineChunks(const char* data, size_t size, vector<TextSpan>& chunks) {
+  chunks.clear();
+  size_t threads = max<size_t>(1, thread::hardware_concurrency());
+  size_t chunkSize = max(MIN_PARSE_CHUNK_SIZE, size / threads + 1);
+  const char* end = data + size;
+  for (const char* begin = data; begin < end;) {
+    const char* cut = size_t(end - begin) > chunkSize ? begin + chunkSize : end;
+    const char* newline = static_cast<const char*>(memchr(cut - 1, '\n', end - cut + 1));
+    cut = NULL == newline ? end : newline + 1;
+    chunks.push_back(TextSpan(begin, cut));
+    begin = cut;
+  }
+}
+
+// Runs func(i, chunks[i]) for all the chunks at once, the first one on the
+// calling thread. func must not throw.
+template <class Func>
+void ParseChunksInParallel(const vector<TextSpan>& chunks, Func func) {
+  vector<thread> threads;
+  for (size_t i = 1; i < chunks.size(); i++) {
+    threads.push_back(thread(func, i, chunks[i]));
+  }
+  if (!chunks.empty()) {
+    func(size_t(0), chunks[0]);
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+// Runs func(worker, i) for every i below count on up to threads threads,
+// the calling thread is worker 0. A thread done with an index takes the next
+// one left, so chunks of uneven cost keep all of them busy. func must not
+// throw.
+template <class Func>
+void RunInParallel(size_t count, size_t threads, Func func) {
+  atomic<size_t> next(0);
+  auto work = [&next, count, &func](size_t worker) {
+    for (size_t i = next++; i < count; i = next++) {
+      func(worker, i);
+    }
+  };
+  vector<thread> pool;
+  for (size_t worker = 1; worker < min(threads, count); worker++) {
+    pool.push_back(thread(work, worker));
+  }
+  work(0);
+  for (size_t i = 0; i < pool.size(); i++) {
+    pool[i].join();
+  }
+}
+
+// Moves cursor past the next line, line gets it without the line break.
+inline bool NextLine(const char*& cursor, const char* end, TextSpan& line) {
+  if (cursor >= end) {
+    return false;
+  }
+  const char* newline = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+  line.begin = cursor;
+  line.end = NULL == newline ? end : newline;
+  cursor = NULL == newline ? end : newline + 1;
+  if (line.end > line.begin && '\r' == line.end[-1]) {
+    line.end--;
+  }
+  return true;
+}
+
+inline TextSpan TrimSpan(TextSpan text) {
+  while (!text.empty() && isspace(static_cast<unsigned char>(*text.begin))) {
+    text.begin++;
+  }
+  while (!text.empty() && isspace(static_cast<unsigned char>(text.end[-1]))) {
+    text.end--;
+  }
+  return text;
+}
+
+// Splits at runs of sep like SplitText() does, returns the number of fields,
+// at most maxFields of them are stored.
+inline size_t SplitSpan(const TextSpan& text, char sep, TextSpan* fields, size_t maxFields) {
+  size_t count = 0;
+  const char* p = text.begin;
+  while (p < text.end) {
+    while (p < text.end && sep == *p) {
+      p++;
+    }
+    if (p == text.end) {
+      break;
+    }
+    const char* start = p;
+    while (p < text.end && sep != *p) {
+      p++;
+    }
+    if (count < maxFields) {
+      fields[count] = TextSpan(start, p);
+    }
+    count++;
+  }
+  return count;
+}
+
+// The whole of text must be a number.
+inline bool ParseDouble(const TextSpan& text, double& value) {
+  const char* begin = text.begin;
+  if (begin < text.end && '+' == *begin) {
+    begin++;
+  }
+  if (begin == text.end) {
+    return false;
+  }
+#if defined(__cpp_lib_to_chars)
+  from_chars_result result = from_chars(begin, text.end, value);
+  return result.ec == errc() && result.ptr == text.end;
+#else
+  // no floating point from_chars in this standard library
+  char buffer[64];
+  size_t size = text.end - begin;
+  if (size >= sizeof(buffer)) {
+    return false;
+  }
+  memcpy(buffer, begin, size);
+  buffer[size] = '\0';
+  char* parsed = NULL;
+  value = strtod(buffer, &parsed);
+  return parsed == buffer + size;
+#endif
+}
+
+// Appends the runes of text, false if it is not valid UTF-8.
+template <class RuneArray>
+bool AppendRunes(const TextSpan& text, RuneArray& runes) {
+  for (const char* p = text.begin; p < text.end;) {
+    RuneStrLite rp = DecodeRuneInString(p, text.end - p);
+    if (0 == rp.len) {
+      return false; // the runes appended so far stay
+    }
+    runes.push_back(rp.rune);
+    p += rp.len;
+  }
+  return true;
+}
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_PARALLEL_PARSER_HPP
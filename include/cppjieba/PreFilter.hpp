@@ -6,6 +6,67 @@
 
 namespace cppjieba {
 
+// The separators of a segment. They are classified by the first byte of
+// their shortest UTF-8 sequence, exactly for ASCII, so most runes are told
+// apart from them by a bit test instead of a hash lookup. The byte is
+// computed from the decoded rune, the text may encode it otherwise.
+class SeparatorSet {
+ public:
+  SeparatorSet() {
+    clear();
+  }
+  // the separators of a set of runes
+  SeparatorSet(const unordered_set<Rune>& runes) {
+    clear();
+    for (unordered_set<Rune>::const_iterator it = runes.begin(); it != runes.end(); ++it) {
+      insert(*it);
+    }
+  }
+
+  // false if rune is in already
+  bool insert(Rune rune) {
+    if (!runes_.insert(rune).second) {
+      return false;
+    }
+    uint8_t lead = LeadByte(rune);
+    leads_[lead >> 6] |= uint64_t(1) << (lead & 63);
+    return true;
+  }
+  void clear() {
+    runes_.clear();
+    memset(leads_, 0, sizeof(leads_));
+  }
+  size_t size() const {
+    return runes_.size();
+  }
+
+  bool Contains(Rune rune) const {
+    uint8_t lead = LeadByte(rune);
+    if (!(leads_[lead >> 6] & (uint64_t(1) << (lead & 63)))) {
+      return false;
+    }
+    return rune < 0x80 || runes_.end() != runes_.find(rune);
+  }
+  const unordered_set<Rune>& Runes() const {
+    return runes_;
+  }
+
+ private:
+  static uint8_t LeadByte(Rune rune) {
+    if (rune < 0x80) {
+      return uint8_t(rune);
+    } else if (rune < 0x800) {
+      return uint8_t(0xc0 | (rune >> 6));
+    } else if (rune < 0x10000) {
+      return uint8_t(0xe0 | (rune >> 12));
+    }
+    return uint8_t(0xf0 | ((rune >> 18) & 0x07));
+  }
+
+  uint64_t leads_[4]; // a bit per first byte of the separators
+  unordered_set<Rune> runes_;
+}; // class SeparatorSet
+
 class PreFilter {
  public:
   //TODO use WordRange instead of Range
@@ -14,22 +75,16 @@ class PreFilter {
     RuneStrArray::const_iterator end;
   }; // struct Range
 
-  PreFilter(const unordered_set<Rune>& symbols, 
-        const string& sentence)
-    : symbols_(symbols) {
-    if (!DecodeRunesInString(sentence, sentence_)) {
-      XLOG(ERROR) << "decode failed. "; 
-    }
-    cursor_ = sentence_.begin();
+  // the separators are found while the sentence is decoded, symbols is not
+  // kept
+  PreFilter(const SeparatorSet& symbols,
+        const string& sentence) {
+    Decode(symbols, sentence.data(), sentence.size());
   }
 
-  PreFilter(const unordered_set<Rune>& symbols, 
-      const string_view & sentence)
-      : symbols_(symbols) {
-      if (!DecodeRunesInString(sentence, sentence_)) {
-          XLOG(ERROR) << "decode failed. "; 
-      }
-      cursor_ = sentence_.begin();
+  PreFilter(const SeparatorSet& symbols,
+      const string_view & sentence) {
+    Decode(symbols, sentence.data(), sentence.size());
   }
 
   ~PreFilter() {
@@ -40,26 +95,44 @@ class PreFilter {
   Range Next() {
     Range range;
     range.begin = cursor_;
-    while (cursor_ != sentence_.end()) {
-      if (Contains(symbols_, cursor_->rune)) {
-        if (range.begin == cursor_) {
-          cursor_ ++;
-        }
-        range.end = cursor_;
-        return range;
-      }
-      cursor_ ++;
+    if (next_ == separators_.size()) {
+      cursor_ = sentence_.end();
+    } else if (cursor_ == sentence_.begin() + separators_[next_]) {
+      // a separator is a range of its own
+      cursor_++;
+      next_++;
+    } else {
+      cursor_ = sentence_.begin() + separators_[next_];
     }
-    range.end = sentence_.end();
+    range.end = cursor_;
     return range;
   }
  private:
+  struct SeparatorFinder {
+    const SeparatorSet& symbols;
+    limonp::LocalVector<uint32_t>& found;
+
+    void operator()(Rune rune, uint32_t index) const {
+      if (symbols.Contains(rune)) {
+        found.push_back(index);
+      }
+    }
+  }; // struct SeparatorFinder
+
+  void Decode(const SeparatorSet& symbols, const char* s, size_t len) {
+    SeparatorFinder finder = {symbols, separators_};
+    if (!DecodeRunes(s, len, sentence_, finder)) {
+      separators_.clear();
+      XLOG(ERROR) << "decode failed. ";
+    }
+    cursor_ = sentence_.begin();
+    next_ = 0;
+  }
+
   RuneStrArray::const_iterator cursor_;
   RuneStrArray sentence_;
-  const unordered_set<Rune>& symbols_;
-
-  template<class KeyType, class ContainType>
-  inline bool Contains ( const ContainType& contain, const KeyType& key ) const { return contain.end() != contain.find(key); }
+  limonp::LocalVector<uint32_t> separators_; // indexes of the separator runes
+  size_t next_; // of the first separator after cursor_
 }; // class PreFilter
 
 } // namespace cppjieba
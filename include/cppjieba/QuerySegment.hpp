@@ -55,24 +55,34 @@ class QuerySegment: public SegmentBase {
 
     mixSeg_.Cut(begin, end, mixRes, hmm, pCtx);
 
+    const DictTrie* trie = trie_;
     for (vector<WordRange>::const_iterator mixResItr = mixRes.begin(); mixResItr != mixRes.end(); mixResItr++) {
-      if (mixResItr->Length() > 2) {
-        for (size_t i = 0; i + 1 < mixResItr->Length(); i++) {
-          WordRange wr(mixResItr->left + i, mixResItr->left + i + 1);
-          if (trie_->Find(wr.left, wr.right + 1) != NULL) {
-            res.push_back(wr);
-          }
+      AddSubWords(*mixResItr, res, [trie](const WordRange& wr) {
+        return trie->Find(wr.left, wr.right + 1) != NULL;
+      });
+      res.push_back(*mixResItr);
+    }
+  }
+
+  // Adds the words of 2 and 3 runes inside of a longer word, isWord(range)
+  // tells the dictionary words.
+  template <class IsWord>
+  static void AddSubWords(const WordRange& word, vector<WordRange>& res, IsWord isWord) {
+    if (word.Length() > 2) {
+      for (size_t i = 0; i + 1 < word.Length(); i++) {
+        WordRange wr(word.left + i, word.left + i + 1);
+        if (isWord(wr)) {
+          res.push_back(wr);
         }
       }
-      if (mixResItr->Length() > 3) {
-        for (size_t i = 0; i + 2 < mixResItr->Length(); i++) {
-          WordRange wr(mixResItr->left + i, mixResItr->left + i + 2);
-          if (trie_->Find(wr.left, wr.right + 1) != NULL) {
-            res.push_back(wr);
-          }
+    }
+    if (word.Length() > 3) {
+      for (size_t i = 0; i + 2 < word.Length(); i++) {
+        WordRange wr(word.left + i, word.left + i + 2);
+        if (isWord(wr)) {
+          res.push_back(wr);
         }
       }
-      res.push_back(*mixResItr);
     }
   }
  private:
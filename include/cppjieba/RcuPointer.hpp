@@ -0,0 +1,115 @@
+#ifndef CPPJIEBA_RCU_POINTER_HPP
+#define CPPJIEBA_RCU_POINTER_HPP
+
+#include <atomic>
+#include <thread>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace cppjieba {
+
+// Owns a value that many threads read while a writer now and then replaces it
+// with a new one (read-copy-update). Readers pin the current value without
+// taking a lock, a writer publishes a modified copy and deletes the previous
+// value once the readers that could have seen it are gone. Readers count
+// themselves in per-thread shards so that they do not fight over one cache
+// line, and in one of two epochs so that a steady stream of new readers does
+// not keep a writer waiting forever. Writers must be serialized by the caller.
+template <class T>
+class RcuPointer {
+ public:
+  explicit RcuPointer(T* value = NULL): value_(value), epoch_(0) {
+    for (size_t i = 0; i < SHARD_NUM; i++) {
+      shards_[i].readers[0].store(0);
+      shards_[i].readers[1].store(0);
+    }
+  }
+  ~RcuPointer() {
+    delete value_.load();
+  }
+
+  // Keeps the value it got alive for its lifetime. Cheap, but not meant to
+  // be held for long: writers wait for it.
+  class ReadGuard {
+   public:
+    explicit ReadGuard(const RcuPointer& owner) {
+      value_ = owner.Pin(counter_);
+    }
+    ~ReadGuard() {
+      counter_->fetch_sub(1);
+    }
+    const T* operator -> () const {
+      return value_;
+    }
+    const T& operator * () const {
+      return *value_;
+    }
+    const T* Get() const {
+      return value_;
+    }
+
+   private:
+    ReadGuard(const ReadGuard&);
+    ReadGuard& operator = (const ReadGuard&);
+
+    std::atomic<uint64_t>* counter_;
+    const T* value_;
+  }; // class ReadGuard
+
+  // the current value, for the writer only
+  T* Get() const {
+    return value_.load();
+  }
+
+  // Makes value the current one, then waits for the readers of the previous
+  // value and deletes it.
+  void Publish(T* value) {
+    T* old = value_.exchange(value);
+    uint64_t epoch = epoch_.fetch_add(1);
+    // everybody who pins from now on counts in the other epoch and gets value
+    for (size_t i = 0; i < SHARD_NUM; i++) {
+      while (shards_[i].readers[epoch & 1].load() != 0) {
+        std::this_thread::yield();
+      }
+    }
+    delete old;
+  }
+
+ private:
+  static const size_t SHARD_NUM = 32;
+
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> readers[2];
+  }; // struct Shard
+
+  const T* Pin(std::atomic<uint64_t>*& counter) const {
+    Shard& shard = shards_[ThreadShard()];
+    for (;;) {
+      uint64_t epoch = epoch_.load();
+      counter = &shard.readers[epoch & 1];
+      counter->fetch_add(1);
+      // a writer that flipped the epoch meanwhile may not have seen us
+      if (epoch_.load() == epoch) {
+        return value_.load();
+      }
+      counter->fetch_sub(1);
+    }
+  }
+
+  static size_t ThreadShard() {
+    static std::atomic<size_t> next(0);
+    thread_local size_t shard = next.fetch_add(1) % SHARD_NUM;
+    return shard;
+  }
+
+  RcuPointer(const RcuPointer&);
+  RcuPointer& operator = (const RcuPointer&);
+
+  std::atomic<T*> value_;
+  std::atomic<uint64_t> epoch_;
+  mutable Shard shards_[SHARD_NUM];
+}; // class RcuPointer
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_RCU_POINTER_HPP
@@ -30,15 +30,18 @@ class SegmentBase {
       return false;
     }
     for (size_t i = 0; i < runes.size(); i++) {
-      if (!symbols_.insert(runes[i].rune).second) {
+      if (!symbols_.insert(runes[i].rune)) {
         XLOG(ERROR) << s.substr(runes[i].offset, runes[i].len) << " already exists";
         return false;
       }
     }
     return true;
   }
+  const SeparatorSet& GetSeparators() const {
+    return symbols_;
+  }
  protected:
-  unordered_set<Rune> symbols_;
+  SeparatorSet symbols_;
 }; // class SegmentBase
 
 } // cppjieba
@@ -0,0 +1,143 @@
+#ifndef CPPJIEBA_STREAM_CUTTER_HPP
+#define CPPJIEBA_STREAM_CUTTER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <istream>
+#include <functional>
+#include "PreFilter.hpp"
+
+namespace cppjieba {
+
+using namespace std;
+
+// What is buffered before a chunk is cut, and read from a stream at once.
+const size_t STREAM_CHUNK_SIZE = 64 * 1024;
+
+// Cuts a text that arrives in pieces, e.g. a log file too big to be held,
+// with memory bound by the chunk size instead of the text size. The text is
+// cut in chunks that end after a separator, and no word crosses a separator,
+// so the words come out as if the whole text had been cut at once. A chunk
+// without any separator is cut at a rune boundary once it reaches the chunk
+// size, a word may be split there. Runes split between pieces are put back
+// together. Word offsets are relative to the whole text, they are 32 bits.
+class StreamCutter {
+ public:
+  // cuts a chunk, offsets relative to the chunk
+  typedef function<void(const std::string_view& chunk, vector<Word>& words)> CutFunc;
+  // gets the words of each chunk cut
+  typedef function<void(const vector<Word>& words)> WordsFunc;
+
+  // separators must be those of the segment cut calls
+  StreamCutter(const SeparatorSet& separators, const CutFunc& cut, const WordsFunc& words,
+        size_t chunkSize = STREAM_CHUNK_SIZE)
+   : separators_(separators), cut_(cut), emit_(words), chunkSize_(chunkSize) {
+    Reset();
+  }
+
+  void Feed(const char* data, size_t size) {
+    while (size > 0) {
+      // piece by piece, so that the buffer stays below twice the chunk size
+      size_t piece = min(size, chunkSize_);
+      buffer_.append(data, piece);
+      data += piece;
+      size -= piece;
+      Scan();
+      if (buffer_.size() >= chunkSize_) {
+        if (boundary_ > 0) {
+          CutChunk(boundary_, boundaryRunes_);
+        } else {
+          CutChunk(scanned_, scannedRunes_);
+        }
+      }
+    }
+  }
+
+  // cuts the rest of the text, the cutter is ready for the next one
+  void Finish() {
+    if (!buffer_.empty()) {
+      CutChunk(buffer_.size(), scannedRunes_);
+    }
+    Reset();
+  }
+
+  // feeds all of is and finishes, false on a read error
+  bool Cut(istream& is) {
+    vector<char> block(chunkSize_);
+    while (is.read(block.data(), block.size()) || is.gcount() > 0) {
+      Feed(block.data(), size_t(is.gcount()));
+    }
+    Finish();
+    return !is.bad();
+  }
+
+ private:
+  // finds the rune boundaries of the bytes not scanned yet
+  void Scan() {
+    while (scanned_ < buffer_.size()) {
+      size_t rest = buffer_.size() - scanned_;
+      RuneStrLite rp = DecodeRuneInString(buffer_.data() + scanned_, rest);
+      if (0 == rp.len) {
+        if (rest < 4) {
+          break; // the rest of the rune is still to come
+        }
+        rp.len = 1; // not UTF-8, the cut of the chunk fails on it
+      }
+      scanned_ += rp.len;
+      scannedRunes_++;
+      if (separators_.Contains(rp.rune)) {
+        boundary_ = scanned_;
+        boundaryRunes_ = scannedRunes_;
+      }
+    }
+  }
+
+  void CutChunk(size_t size, size_t runes) {
+    words_.clear();
+    cut_(std::string_view(buffer_.data(), size), words_);
+    for (size_t i = 0; i < words_.size(); i++) {
+      words_[i].offset += offset_;
+      words_[i].unicode_offset += unicodeOffset_;
+    }
+    if (!words_.empty()) {
+      emit_(words_);
+    }
+    buffer_.erase(0, size);
+    offset_ += uint32_t(size);
+    unicodeOffset_ += uint32_t(runes);
+    scanned_ -= size;
+    scannedRunes_ -= runes;
+    // the chunk ended at the last separator or there was none
+    boundary_ = 0;
+    boundaryRunes_ = 0;
+  }
+
+  void Reset() {
+    buffer_.clear();
+    offset_ = 0;
+    unicodeOffset_ = 0;
+    scanned_ = 0;
+    scannedRunes_ = 0;
+    boundary_ = 0;
+    boundaryRunes_ = 0;
+  }
+
+  SeparatorSet separators_;
+  CutFunc cut_;
+  WordsFunc emit_;
+  size_t chunkSize_;
+
+  string buffer_;
+  vector<Word> words_;
+  uint32_t offset_;        // of the buffer in the text
+  uint32_t unicodeOffset_;
+  size_t scanned_;         // bytes of the buffer split into runes
+  size_t scannedRunes_;
+  size_t boundary_;        // end of the last separator in the buffer, 0 - none
+  size_t boundaryRunes_;
+}; // class StreamCutter
+
+} // namespace cppjieba
+
+#endif // CPPJIEBA_STREAM_CUTTER_HPP
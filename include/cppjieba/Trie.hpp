@@ -3,19 +3,31 @@
 
 #include <vector>
 #include <queue>
+#include <algorithm>
+#include <stdint.h>
 #include "limonp/StdExtension.hpp"
 #include "Unicode.hpp"
+#include "FlatArray.hpp"
+#include "LargePageAllocator.hpp"
+#include "MemoryStats.hpp"
 
 namespace cppjieba {
 
 using namespace std;
 
 const size_t MAX_WORD_LENGTH = 512;
+const double MIN_DOUBLE = -3.14e+100;
+const double MAX_DOUBLE = 3.14e+100;
 
+// A dictionary word. Its runes live in the rune pool of the owning DictTrie
+// and its tag in the tag table there, see DictTrie::GetWord() and GetTag().
 struct DictUnit {
-  Unicode word;
-  double weight;
-  string tag;
+  uint32_t wordOffset;
+  uint16_t wordLength; // in runes
+  uint16_t tag;
+  float weight;
+  DictUnit(): wordOffset(0), wordLength(0), tag(0), weight(0.0f) {
+  }
 }; // struct DictUnit
 
 // for debugging
@@ -25,6 +37,7 @@ struct DictUnit {
 //   return os << StringFormat("%s %s %.3lf", s.c_str(), unit.tag.c_str(), unit.weight);
 // }
 
+// The DAG of a text a position at a time, see DictTrie::Find().
 struct Dag {
   RuneStr runestr;
   // [offset, nexts.first]
@@ -36,38 +49,153 @@ struct Dag {
   }
 }; // struct Dag
 
+// A word of the DAG of a text, from its position up to end, unit NULL for a
+// single rune not in the dictionary.
+struct DagEdge {
+  uint32_t end;
+  const DictUnit* unit;
+  DagEdge(): end(0), unit(NULL) {
+  }
+  DagEdge(size_t e, const DictUnit* u): end(uint32_t(e)), unit(u) {
+  }
+}; // struct DagEdge
+
+// the edges of a single position
+typedef limonp::LocalVector<DagEdge> DagEdges;
+
+// The DAG of a text in CSR form, the edges of position i, in the order of
+// their end, are edges[offsets[i]] up to edges[offsets[i + 1]]. Most
+// positions have one or two edges, the lattice takes no room for more.
+struct DagLattice {
+  vector<DagEdge> edges;
+  vector<uint32_t> offsets;
+
+  DagLattice(): offsets(1, 0) {
+  }
+  size_t size() const {
+    return offsets.size() - 1;
+  }
+  // keeps the memory for the next text
+  void clear() {
+    edges.clear();
+    offsets.resize(1);
+  }
+  // the edges added since the last position are those of the next one
+  void ClosePosition() {
+    offsets.push_back(uint32_t(edges.size()));
+  }
+  const DagEdge* EdgesBegin(size_t i) const {
+    return edges.data() + offsets[i];
+  }
+  const DagEdge* EdgesEnd(size_t i) const {
+    return edges.data() + offsets[i + 1];
+  }
+  size_t EdgeCount(size_t i) const {
+    return offsets[i + 1] - offsets[i];
+  }
+  // the unit of the word from i up to end, NULL if there is none
+  const DictUnit* FindEdge(size_t i, size_t end) const {
+    for (const DagEdge* edge = EdgesBegin(i); edge != EdgesEnd(i) && edge->end <= end; edge++) {
+      if (edge->end == end) {
+        return edge->unit;
+      }
+    }
+    return NULL;
+  }
+  void swap(DagLattice& other) {
+    edges.swap(other.edges);
+    offsets.swap(other.offsets);
+  }
+}; // struct DagLattice
+
+// The best cut of a text from a position on: its first word, NULL for a
+// single rune not in the dictionary, and the weight of the whole cut.
+struct DagPath {
+  const DictUnit* pInfo;
+  double weight;
+}; // struct DagPath
+
 struct CutContext
 {
     vector<WordRange>   wrs;
-    vector<Dag>         dags;
+    DagLattice          lattice;
+    vector<DagPath>     paths;
     vector<WordRange>   hmmRes;
     vector<WordRange>   mixRes;
     vector<WordRange>   mixWords;
-    vector<int>         path;
-    vector<double>      weight;
+    vector<uint8_t>     path;
     vector<size_t>      status;
 };
 
 typedef Rune TrieKey;
 
-class TrieNode {
- public :
-  TrieNode(): next(NULL), ptValue(NULL) {
+// One state of the double-array trie. base/check/value live side by side so
+// that a transition costs a single cache line fetch.
+struct TrieUnit {
+  int32_t base;   // children of this state live at base + code, 0 - no children
+  int32_t check;  // parent state, negative - free slot
+  uint32_t value; // index into the values table, 0 - no word ends here
+  TrieUnit(): base(0), check(-1), value(0) {
   }
- public:
-  typedef unordered_map<TrieKey, TrieNode*> NextMap;
-  NextMap *next;
-  const DictUnit *ptValue;
-};
+}; // struct TrieUnit
+
+// Direct entry into the trie for a BMP rune, saves the root transition and
+// bounds the walk by the longest word starting with the rune.
+struct TrieRoot {
+  int32_t state;      // child of the root for the rune, 0 - none
+  uint32_t maxLength; // in runes, an upper bound once words got deleted
+}; // struct TrieRoot
+
+// Aho-Corasick links of a state, see Trie::BuildAutomaton().
+struct TrieLink {
+  int32_t fail;   // state of the longest proper suffix in the trie
+  int32_t output; // state of the longest proper suffix that is a word, 0 - none
+  uint32_t depth; // in runes
+  TrieLink(): fail(0), output(0), depth(0) {
+  }
+}; // struct TrieLink
+
+// code of a rune outside the BMP, kept sorted by rune
+struct TrieCode {
+  Rune rune;
+  uint32_t code;
+}; // struct TrieCode
+
+inline bool operator < (const TrieCode& lhs, const TrieCode& rhs) {
+  return lhs.rune < rhs.rune;
+}
+
+// The flat arrays a trie consists of, values aside. Used to save a trie into
+// a dictionary image and to run one straight from it.
+struct TrieImage {
+  const TrieUnit* units;
+  size_t unitCount;
+  const uint32_t* bmpCodes; // 0x10000 entries
+  const TrieRoot* roots;     // 0x10000 entries
+  const TrieCode* supplementaryCodes;
+  size_t supplementaryCount;
+  uint32_t alphabetSize;
+}; // struct TrieImage
 
 class Trie {
+  static const int32_t MAX_ANCHOR_TRIALS = 8;
+  static const int32_t CHECK_DETACHED = -MAX_ANCHOR_TRIALS - 2;
  public:
   Trie(const vector<Unicode>& keys, const vector<const DictUnit*>& valuePointers)
-   : root_(new TrieNode) {
+   : freeHead_(-1), alphabetSize_(0) {
     CreateTrie(keys, valuePointers);
   }
+  // Uses the arrays of image in place until the first modification. values is
+  // the whole values table, values[0] must be NULL.
+  Trie(const TrieImage& image, const vector<const DictUnit*>& values)
+   : values_(values), freeHead_(-1), alphabetSize_(image.alphabetSize) {
+    assert(!values_.empty() && NULL == values_[0]);
+    units_.Map(image.units, image.unitCount);
+    bmpCodes_.Map(image.bmpCodes, BMP_CODE_COUNT);
+    roots_.Map(image.roots, BMP_CODE_COUNT);
+    supplementaryCodes_.Map(image.supplementaryCodes, image.supplementaryCount);
+  }
   ~Trie() {
-    DeleteNode(root_);
   }
 
   const DictUnit* Find(RuneStrArray::const_iterator begin, RuneStrArray::const_iterator end) const {
@@ -75,137 +203,713 @@ class Trie {
       return NULL;
     }
 
-    const TrieNode* ptNode = root_;
-    TrieNode::NextMap::const_iterator citer;
-    for (RuneStrArray::const_iterator it = begin; it != end; it++) {
-      if (NULL == ptNode->next) {
-        return NULL;
-      }
-      citer = ptNode->next->find(it->rune);
-      if (ptNode->next->end() == citer) {
+    int32_t state = 0;
+    size_t maxLength = end - begin;
+    if (!TransitRoot(state, maxLength, begin->rune) || maxLength < size_t(end - begin)) {
+      return NULL;
+    }
+    for (RuneStrArray::const_iterator it = begin + 1; it != end; it++) {
+      if (!Transit(state, it->rune)) {
         return NULL;
       }
-      ptNode = citer->second;
     }
-    return ptNode->ptValue;
+    return values_[units_[state].value];
   }
 
   void Find(RuneStrArray::const_iterator begin, 
         RuneStrArray::const_iterator end, 
-        vector<struct Dag>&res, 
+        DagLattice& lattice,
         size_t max_word_len = MAX_WORD_LENGTH) const {
-    assert(root_ != NULL);
-    res.resize(end - begin);
-
-    const TrieNode *ptNode = NULL;
-    TrieNode::NextMap::const_iterator citer;
+    lattice.clear();
+    if (!links_.empty()) {
+      FindByAutomaton(begin, end, lattice, max_word_len);
+      return;
+    }
     for (size_t i = 0; i < size_t(end - begin); i++) {
-      res[i].runestr = *(begin + i);
+      FindFrom(begin, end, i, max_word_len, lattice.edges);
+      lattice.ClosePosition();
+    }
+  }
 
-      if (root_->next != NULL && root_->next->end() != (citer = root_->next->find(res[i].runestr.rune))) {
-        ptNode = citer->second;
-      } else {
-        ptNode = NULL;
+  // Appends the edges of position i of the DAG, the words starting there.
+  template <class Edges>
+  void FindFrom(RuneStrArray::const_iterator begin,
+        RuneStrArray::const_iterator end,
+        size_t i,
+        size_t max_word_len,
+        Edges& edges) const {
+    int32_t state = 0;
+    size_t maxLength = max_word_len;
+    if (!TransitRoot(state, maxLength, (begin + i)->rune)) {
+      edges.push_back(DagEdge(i, NULL));
+      return;
+    }
+    edges.push_back(DagEdge(i, values_[units_[state].value]));
+
+    for (size_t j = i + 1; j < size_t(end - begin) && (j - i + 1) <= maxLength; j++) {
+      if (!Transit(state, (begin + j)->rune)) {
+        break;
       }
-      if (ptNode != NULL) {
-        res[i].nexts.push_back(pair<size_t, const DictUnit*>(i, ptNode->ptValue));
-      } else {
-        res[i].nexts.push_back(pair<size_t, const DictUnit*>(i, static_cast<const DictUnit*>(NULL)));
+      const DictUnit* value = values_[units_[state].value];
+      if (NULL != value) {
+        edges.push_back(DagEdge(j, value));
       }
+    }
+  }
 
-      for (size_t j = i + 1; j < size_t(end - begin) && (j - i + 1) <= max_word_len; j++) {
-        if (ptNode == NULL || ptNode->next == NULL) {
-          break;
-        }
-        citer = ptNode->next->find((begin + j)->rune);
-        if (ptNode->next->end() == citer) {
-          break;
-        }
-        ptNode = citer->second;
-        if (NULL != ptNode->ptValue) {
-          res[i].nexts.push_back(pair<size_t, const DictUnit*>(j, ptNode->ptValue));
-        }
+  // false unless the DAG is built by the automaton
+  bool HasAutomaton() const {
+    return !links_.empty();
+  }
+
+  void InsertNode(const Unicode& key, const DictUnit* ptValue) {
+    if (key.begin() == key.end()) {
+      return;
+    }
+    Detach();
+
+    int32_t state = 0;
+    for (Unicode::const_iterator citer = key.begin(); citer != key.end(); ++citer) {
+      uint32_t code = GetCode(*citer);
+      if (0 == code) {
+        code = AddCode(*citer);
+      }
+      int32_t next = GetChild(state, code);
+      if (next < 0) {
+        next = AddChild(state, code);
       }
+      state = next;
+    }
+    units_[state].value = AddValue(ptValue);
+    Rune first = key[0];
+    if (first < roots_.size()) {
+      roots_[first].state = GetChild(0, GetCode(first));
+      roots_[first].maxLength = max(roots_[first].maxLength, uint32_t(key.size()));
+    }
+    if (!links_.empty()) {
+      // states may have moved, links are cheap enough to redo
+      BuildAutomaton();
     }
   }
 
-  void InsertNode(const Unicode& key, const DictUnit* ptValue) {
+  void DeleteNode(const Unicode& key, const DictUnit* ptValue) {
     if (key.begin() == key.end()) {
       return;
     }
 
-    TrieNode::NextMap::const_iterator kmIter;
-    TrieNode *ptNode = root_;
+    int32_t state = 0;
     for (Unicode::const_iterator citer = key.begin(); citer != key.end(); ++citer) {
-      if (NULL == ptNode->next) {
-        ptNode->next = new TrieNode::NextMap;
+      if (!Transit(state, *citer)) {
+        return;
+      }
+    }
+    Detach();
+    // the states stay in place, the word just stops being reported
+    units_[state].value = 0;
+  }
+
+  // Adds failure and output links so that Find() builds the DAG in one pass
+  // over the sentence instead of walking the trie from every position. Takes
+  // O(states), InsertNode() redoes it while the links are present.
+  void BuildAutomaton() {
+    size_t size = units_.size();
+    vector<TrieLink> links(size);
+
+    // the children of every state, collected from the check array
+    vector<uint32_t> offsets(size + 1, 0);
+    for (size_t i = 1; i < size; i++) {
+      if (units_[i].check >= 0) {
+        offsets[units_[i].check + 1]++;
+      }
+    }
+    for (size_t i = 0; i < size; i++) {
+      offsets[i + 1] += offsets[i];
+    }
+    vector<int32_t> children(offsets[size]);
+    vector<uint32_t> cursors(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 1; i < size; i++) {
+      if (units_[i].check >= 0) {
+        children[cursors[units_[i].check]++] = int32_t(i);
+      }
+    }
+
+    // parents get their links before their children
+    vector<int32_t> queue(1, 0);
+    queue.reserve(children.size() + 1);
+    for (size_t q = 0; q < queue.size(); q++) {
+      int32_t state = queue[q];
+      for (uint32_t c = offsets[state]; c < offsets[state + 1]; c++) {
+        int32_t child = children[c];
+        int32_t fail = 0;
+        if (0 != state) {
+          uint32_t code = uint32_t(child - units_[state].base);
+          int32_t next = -1;
+          for (fail = links[state].fail; (next = GetChild(fail, code)) < 0 && 0 != fail; fail = links[fail].fail) {
+          }
+          fail = next < 0 ? 0 : next;
+        }
+        TrieLink& link = links[child];
+        link.depth = links[state].depth + 1;
+        link.fail = fail;
+        link.output = NULL != values_[units_[fail].value] ? fail : links[fail].output;
+        queue.push_back(child);
+      }
+    }
+    links_.swap(links);
+  }
+
+  void GetImage(TrieImage& image) const {
+    image.units = units_.data();
+    image.unitCount = units_.size();
+    image.bmpCodes = bmpCodes_.data();
+    image.roots = roots_.data();
+    image.supplementaryCodes = supplementaryCodes_.data();
+    image.supplementaryCount = supplementaryCodes_.size();
+    image.alphabetSize = alphabetSize_;
+  }
+
+  // True if every index a trie on image follows stays within its arrays: the
+  // states of the roots and the parents, the codes and the values. Bases are
+  // bounds checked by the walk itself.
+  static bool IsValidImage(const TrieImage& image, size_t valueCount) {
+    size_t unitCount = image.unitCount;
+    if (0 == unitCount || 0 != image.units[0].check) {
+      return false;
+    }
+    for (size_t i = 0; i < unitCount; i++) {
+      const TrieUnit& unit = image.units[i];
+      if (unit.value >= valueCount) {
+        return false;
+      }
+      if (unit.check >= 0 && (size_t(unit.check) >= unitCount || unit.base < 0)) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < BMP_CODE_COUNT; i++) {
+      if (image.roots[i].state < 0 || size_t(image.roots[i].state) >= unitCount || image.bmpCodes[i] > image.alphabetSize) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < image.supplementaryCount; i++) {
+      if (image.supplementaryCodes[i].code > image.alphabetSize
+          || (i && !(image.supplementaryCodes[i - 1] < image.supplementaryCodes[i]))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const vector<const DictUnit*>& GetValues() const {
+    return values_;
+  }
+
+  // the values of the words in the trie, in no particular order
+  void CollectValues(vector<const DictUnit*>& values) const {
+    values.clear();
+    for (size_t i = 1; i < units_.size(); i++) {
+      if (units_[i].check >= 0 && 0 != units_[i].value && NULL != values_[units_[i].value]) {
+        values.push_back(values_[units_[i].value]);
       }
-      kmIter = ptNode->next->find(*citer);
-      if (ptNode->next->end() == kmIter) {
-        TrieNode *nextNode = new TrieNode;
+    }
+  }
+
+  void GetMemoryStats(MemoryStats& stats) const {
+    stats.Add("units", units_.size(), units_.size() * sizeof(TrieUnit), !units_.IsOwner());
+    stats.Add("values", values_.size(), values_.capacity() * sizeof(values_[0]));
+    stats.Add("bmp_codes", bmpCodes_.size(), bmpCodes_.size() * sizeof(uint32_t), !bmpCodes_.IsOwner());
+    stats.Add("roots", roots_.size(), roots_.size() * sizeof(TrieRoot), !roots_.IsOwner());
+    stats.Add("supplementary_codes", supplementaryCodes_.size(), supplementaryCodes_.size() * sizeof(TrieCode), !supplementaryCodes_.IsOwner());
+    stats.Add("links", links_.size(), links_.capacity() * sizeof(TrieLink));
+
+    // depths are found going up to the nearest state whose depth is known
+    vector<uint32_t> depths(units_.size(), UINT32_MAX);
+    vector<int32_t> path;
+    depths[0] = 0;
+    stats.trieStates++;
+    stats.AddDepth(0);
+    for (size_t i = 1; i < units_.size(); i++) {
+      if (units_[i].check < 0) {
+        continue;
+      }
+      int32_t state = int32_t(i);
+      for (path.clear(); UINT32_MAX == depths[state]; state = units_[state].check) {
+        path.push_back(state);
+      }
+      for (size_t j = path.size(); j > 0; j--) {
+        depths[path[j - 1]] = depths[state] + uint32_t(path.size() - j + 1);
+      }
+      stats.trieStates++;
+      stats.AddDepth(depths[i]);
+    }
+  }
+
+ private:
+  static const size_t BMP_CODE_COUNT = 0x10000;
+
+  // takes a private copy of mapped arrays before they get modified
+  void Detach() {
+    if (units_.IsOwner() && bmpCodes_.IsOwner() && roots_.IsOwner() && supplementaryCodes_.IsOwner()) {
+      return;
+    }
+    units_.Detach();
+    bmpCodes_.Detach();
+    roots_.Detach();
+    supplementaryCodes_.Detach();
+    RelinkFree();
+  }
 
-        ptNode->next->insert(make_pair(*citer, nextNode));
-        ptNode = nextNode;
+
+  // Same result as the walk from every position: each position starts with its
+  // single rune entry, longer words are appended as the pass reaches their end.
+  // The pass finds the edges by their end, they are sorted by their position
+  // afterwards, keeping their order.
+  void FindByAutomaton(RuneStrArray::const_iterator begin,
+        RuneStrArray::const_iterator end,
+        DagLattice& lattice,
+        size_t max_word_len) const {
+    size_t size = end - begin;
+    vector<DagEdge> found;
+    vector<uint32_t> starts;
+    found.reserve(size * 2);
+    starts.reserve(size * 2);
+
+    int32_t state = 0;
+    for (size_t j = 0; j < size; j++) {
+      Rune rune = (begin + j)->rune;
+
+      int32_t single = 0;
+      size_t maxLength = 1;
+      if (TransitRoot(single, maxLength, rune)) {
+        found.push_back(DagEdge(j, values_[units_[single].value]));
       } else {
-        ptNode = kmIter->second;
+        found.push_back(DagEdge(j, NULL));
+      }
+      starts.push_back(uint32_t(j));
+
+      // a rune may still continue words it does not start
+      uint32_t code = GetCode(rune);
+      int32_t next = -1;
+      while (0 != code && (next = GetChild(state, code)) < 0 && 0 != state) {
+        state = links_[state].fail;
+      }
+      state = next < 0 ? 0 : next;
+
+      // depths fall along the output chain, single runes were handled above
+      for (int32_t s = state; 0 != s && links_[s].depth > 1; s = links_[s].output) {
+        size_t depth = links_[s].depth;
+        const DictUnit* value = values_[units_[s].value];
+        if (NULL != value && depth <= max_word_len) {
+          found.push_back(DagEdge(j, value));
+          starts.push_back(uint32_t(j + 1 - depth));
+        }
       }
     }
-    assert(ptNode != NULL);
-    ptNode->ptValue = ptValue;
+
+    lattice.offsets.assign(size + 1, 0);
+    for (size_t k = 0; k < starts.size(); k++) {
+      lattice.offsets[starts[k] + 1]++;
+    }
+    for (size_t i = 0; i < size; i++) {
+      lattice.offsets[i + 1] += lattice.offsets[i];
+    }
+    vector<uint32_t> cursors(lattice.offsets.begin(), lattice.offsets.end() - 1);
+    lattice.edges.resize(found.size());
+    for (size_t k = 0; k < found.size(); k++) {
+      lattice.edges[cursors[starts[k]]++] = found[k];
+    }
   }
-  void DeleteNode(const Unicode& key, const DictUnit* ptValue) {
-      if (key.begin() == key.end()) {
-        return;
+
+  // first step of a walk, narrows maxLength down to the longest word starting with rune
+  bool TransitRoot(int32_t& state, size_t& maxLength, Rune rune) const {
+    if (rune < roots_.size()) {
+      const TrieRoot& root = roots_[rune];
+      state = root.state;
+      maxLength = min(maxLength, size_t(root.maxLength));
+      return 0 != state;
+    }
+    return Transit(state, rune);
+  }
+
+  bool Transit(int32_t& state, Rune rune) const {
+    uint32_t code = GetCode(rune);
+    int32_t base = units_[state].base;
+    if (0 == code || 0 == base) {
+      return false;
+    }
+    size_t next = size_t(base) + code;
+    if (next >= units_.size() || units_[next].check != state) {
+      return false;
+    }
+    state = int32_t(next);
+    return true;
+  }
+
+  uint32_t GetCode(Rune rune) const {
+    if (rune < bmpCodes_.size()) {
+      return bmpCodes_[rune];
+    }
+    TrieCode item = {rune, 0};
+    FlatArray<TrieCode>::const_iterator it = lower_bound(supplementaryCodes_.begin(), supplementaryCodes_.end(), item);
+    if (it == supplementaryCodes_.end() || it->rune != rune) {
+      return 0;
+    }
+    return it->code;
+  }
+
+  uint32_t AddCode(Rune rune) {
+    uint32_t code = ++alphabetSize_;
+    if (rune < bmpCodes_.size()) {
+      bmpCodes_[rune] = code;
+    } else {
+      TrieCode item = {rune, code};
+      supplementaryCodes_.insert(lower_bound(supplementaryCodes_.begin(), supplementaryCodes_.end(), item) - supplementaryCodes_.begin(), item);
+    }
+    return code;
+  }
+
+  uint32_t AddValue(const DictUnit* ptValue) {
+    values_.push_back(ptValue);
+    return uint32_t(values_.size() - 1);
+  }
+
+  int32_t GetChild(int32_t state, uint32_t code) const {
+    int32_t base = units_[state].base;
+    if (0 == base) {
+      return -1;
+    }
+    size_t next = size_t(base) + code;
+    if (next >= units_.size() || units_[next].check != state) {
+      return -1;
+    }
+    return int32_t(next);
+  }
+
+  void Reserve(size_t size) {
+    if (size <= units_.size()) {
+      return;
+    }
+    size_t old = units_.size();
+    units_.resize(max(size, units_.size() * 2));
+    for (size_t i = old; i < units_.size(); i++) {
+      LinkFree(int32_t(i));
+    }
+  }
+
+  // Free slots form a circular list threaded through their unused base (next) and value (prev) fields.
+  void LinkFree(int32_t pos) {
+    units_[pos].check = -1;
+    if (freeHead_ < 0) {
+      units_[pos].base = pos;
+      units_[pos].value = uint32_t(pos);
+      freeHead_ = pos;
+      return;
+    }
+    int32_t tail = int32_t(units_[freeHead_].value);
+    units_[pos].base = freeHead_;
+    units_[pos].value = uint32_t(tail);
+    units_[tail].base = pos;
+    units_[freeHead_].value = uint32_t(pos);
+  }
+
+  void UnlinkFree(int32_t pos) {
+    int32_t next = units_[pos].base;
+    int32_t prev = int32_t(units_[pos].value);
+    if (next == pos) {
+      freeHead_ = -1;
+    } else {
+      units_[prev].base = next;
+      units_[next].value = uint32_t(prev);
+      if (freeHead_ == pos) {
+        freeHead_ = next;
       }
-      //定义一个NextMap迭代器
-      TrieNode::NextMap::const_iterator kmIter;
-      //定义一个指向root的TrieNode指针
-      TrieNode *ptNode = root_;
-      for (Unicode::const_iterator citer = key.begin(); citer != key.end(); ++citer) {
-        //链表不存在元素
-        if (NULL == ptNode->next) {
-          return;
+    }
+  }
+
+  void Claim(int32_t pos, int32_t parent) {
+    assert(units_[pos].check < 0);
+    if (units_[pos].check > CHECK_DETACHED) {
+      UnlinkFree(pos);
+    }
+    units_[pos] = TrieUnit();
+    units_[pos].check = parent;
+  }
+
+  void Release(int32_t pos) {
+    units_[pos] = TrieUnit();
+    LinkFree(pos);
+  }
+
+  // Finds a base for which every base + codes[i] slot is free, codes are sorted ascending.
+  int32_t FindBase(const vector<uint32_t>& codes) {
+    assert(!codes.empty());
+    if (freeHead_ < 0) {
+      Reserve(units_.size() + 1);
+    }
+    int32_t first = freeHead_;
+    int32_t pos = first;
+    while (true) {
+      int32_t next = units_[pos].base;
+      if (uint32_t(pos) > codes.front()) {
+        size_t base = size_t(pos) - codes.front();
+        Reserve(base + codes.back() + 1);
+        next = units_[pos].base;
+        bool ok = true;
+        for (size_t i = 1; i < codes.size(); i++) {
+          if (units_[base + codes[i]].check >= 0) {
+            ok = false;
+            break;
+          }
         }
-        kmIter = ptNode->next->find(*citer);
-        //如果map中不存在,跳出循环
-        if (ptNode->next->end() == kmIter) {
-              break;
+        if (ok) {
+          return int32_t(base);
+        }
+        // a slot that keeps failing as an anchor sits in a crowded area, stop trying it
+        if (--units_[pos].check < -MAX_ANCHOR_TRIALS) {
+          UnlinkFree(pos);
+          units_[pos].check = CHECK_DETACHED;
+          if (next == pos) {
+            next = -1;
+          } else if (pos == first) {
+            first = next;
+            pos = next;
+            continue;
+          }
         }
-        //从unordered_map中擦除该项
-        ptNode->next->erase(*citer);
-        //删除该node
-        ptNode = kmIter->second;
-        delete ptNode;
-        break;
       }
+      if (next < 0 || next == first) {
+        // went around the whole free list, place the children past the end
+        size_t base = max(units_.size(), size_t(codes.front()) + 1) - codes.front();
+        Reserve(base + codes.back() + 1);
+        return int32_t(base);
+      }
+      pos = next;
+    }
+  }
+
+  void CollectChildren(int32_t state, vector<uint32_t>& codes) const {
+    codes.clear();
+    int32_t base = units_[state].base;
+    if (0 == base) {
       return;
- }
- private:
+    }
+    for (uint32_t code = 1; code <= alphabetSize_ && size_t(base) + code < units_.size(); code++) {
+      if (units_[base + code].check == state) {
+        codes.push_back(code);
+      }
+    }
+  }
+
+  int32_t AddChild(int32_t state, uint32_t code) {
+    int32_t base = units_[state].base;
+    if (0 != base) {
+      Reserve(size_t(base) + code + 1);
+      if (units_[base + code].check < 0) {
+        Claim(base + code, state);
+        return base + code;
+      }
+    }
+
+    // no room next to the existing siblings, move all children of state to a new base
+    vector<uint32_t> codes;
+    CollectChildren(state, codes);
+    codes.insert(lower_bound(codes.begin(), codes.end(), code), code);
+    int32_t newBase = FindBase(codes);
+    vector<uint32_t> grandchildren;
+    for (size_t i = 0; i < codes.size(); i++) {
+      if (codes[i] == code) {
+        continue;
+      }
+      int32_t from = base + codes[i];
+      int32_t to = newBase + codes[i];
+      Claim(to, state);
+      units_[to] = units_[from];
+      CollectChildren(from, grandchildren);
+      for (size_t j = 0; j < grandchildren.size(); j++) {
+        units_[units_[from].base + grandchildren[j]].check = to;
+      }
+      Release(from);
+    }
+    units_[state].base = newBase;
+    Claim(newBase + code, state);
+    if (0 == state) {
+      RefreshRoots();
+    }
+    return newBase + code;
+  }
+
   void CreateTrie(const vector<Unicode>& keys, const vector<const DictUnit*>& valuePointers) {
+    values_.assign(1, static_cast<const DictUnit*>(NULL));
+    bmpCodes_.assign(BMP_CODE_COUNT, 0);
+    roots_.assign(BMP_CODE_COUNT, TrieRoot());
+    units_.assign(1, TrieUnit());
+    units_[0].check = 0;
     if (valuePointers.empty() || keys.empty()) {
       return;
     }
     assert(keys.size() == valuePointers.size());
 
-    for (size_t i = 0; i < keys.size(); i++) {
-      InsertNode(keys[i], valuePointers[i]);
+    CreateAlphabet(keys);
+
+    // equal prefixes must be adjacent, later duplicates win like repeated InsertNode did
+    vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&keys](size_t lhs, size_t rhs) {
+      return lexicographical_compare(keys[lhs].begin(), keys[lhs].end(), keys[rhs].begin(), keys[rhs].end());
+    });
+
+    // Lay the trie out level by level first, every node keeps its children contiguous.
+    struct Node {
+      size_t begin;
+      size_t end;
+      size_t depth;
+      size_t firstChild;
+      size_t childCount;
+      uint32_t code;
+      uint32_t value;
+      int32_t base;
+    };
+    vector<Node> nodes;
+    Node root = {0, order.size(), 0, 0, 0, 0, 0, 0};
+    nodes.push_back(root);
+    for (size_t n = 0; n < nodes.size(); n++) {
+      size_t i = nodes[n].begin;
+      size_t end = nodes[n].end;
+      size_t depth = nodes[n].depth;
+      while (i < end && keys[order[i]].size() == depth) {
+        if (depth > 0) {
+          nodes[n].value = AddValue(valuePointers[order[i]]);
+        }
+        i++;
+      }
+      nodes[n].firstChild = nodes.size();
+      while (i < end) {
+        Rune rune = keys[order[i]][depth];
+        size_t j = i + 1;
+        while (j < end && keys[order[j]][depth] == rune) {
+          j++;
+        }
+        Node child = {i, j, depth + 1, 0, 0, GetCode(rune), 0, 0};
+        nodes.push_back(child);
+        i = j;
+      }
+      nodes[n].childCount = nodes.size() - nodes[n].firstChild;
     }
+
+    // Place the widest nodes while the array is still empty, single child nodes fill the gaps later.
+    vector<size_t> placement;
+    for (size_t n = 0; n < nodes.size(); n++) {
+      if (nodes[n].childCount) {
+        placement.push_back(n);
+      }
+    }
+    stable_sort(placement.begin(), placement.end(), [&nodes](size_t lhs, size_t rhs) {
+      return nodes[lhs].childCount > nodes[rhs].childCount;
+    });
+    vector<uint32_t> codes;
+    size_t relinkBelow = placement.empty() ? 0 : nodes[placement.front()].childCount / 2;
+    for (size_t k = 0; k < placement.size(); k++) {
+      Node& node = nodes[placement[k]];
+      if (node.childCount < relinkBelow) {
+        // slots given up by wider nodes may still suit narrower ones
+        RelinkFree();
+        relinkBelow = node.childCount / 2;
+      }
+      codes.clear();
+      for (size_t c = node.firstChild; c < node.firstChild + node.childCount; c++) {
+        codes.push_back(nodes[c].code);
+      }
+      sort(codes.begin(), codes.end());
+      node.base = FindBase(codes);
+      for (size_t c = 0; c < codes.size(); c++) {
+        Claim(node.base + codes[c], 0);
+      }
+    }
+
+    // Now that every base is known, link the states to their parents.
+    vector<int32_t> states(nodes.size(), 0);
+    units_[0].base = nodes[0].base;
+    for (size_t n = 0; n < nodes.size(); n++) {
+      for (size_t c = nodes[n].firstChild; c < nodes[n].firstChild + nodes[n].childCount; c++) {
+        states[c] = nodes[n].base + nodes[c].code;
+        TrieUnit& unit = units_[states[c]];
+        unit.base = nodes[c].base;
+        unit.check = states[n];
+        unit.value = nodes[c].value;
+      }
+    }
+    for (size_t c = nodes[0].firstChild; c < nodes[0].firstChild + nodes[0].childCount; c++) {
+      Rune rune = keys[order[nodes[c].begin]][0];
+      if (rune >= roots_.size()) {
+        continue;
+      }
+      TrieRoot& root = roots_[rune];
+      root.state = states[c];
+      for (size_t i = nodes[c].begin; i < nodes[c].end; i++) {
+        root.maxLength = max(root.maxLength, uint32_t(keys[order[i]].size()));
+      }
+    }
+    Shrink();
   }
 
-  void DeleteNode(TrieNode* node) {
-    if (NULL == node) {
-      return;
+  // the children of the root have been moved
+  void RefreshRoots() {
+    for (Rune rune = 0; rune < roots_.size(); rune++) {
+      if (0 != roots_[rune].state) {
+        roots_[rune].state = GetChild(0, bmpCodes_[rune]);
+      }
+    }
+  }
+
+  // Drops the free tail left by the array growth and rebuilds the free list.
+  void Shrink() {
+    size_t size = units_.size();
+    while (size > 1 && units_[size - 1].check < 0) {
+      size--;
     }
-    if (NULL != node->next) {
-      for (TrieNode::NextMap::iterator it = node->next->begin(); it != node->next->end(); ++it) {
-        DeleteNode(it->second);
+    units_.shrink(size);
+    RelinkFree();
+  }
+
+  void RelinkFree() {
+    freeHead_ = -1;
+    for (size_t i = 0; i < units_.size(); i++) {
+      if (units_[i].check < 0) {
+        LinkFree(int32_t(i));
       }
-      delete node->next;
     }
-    delete node;
   }
 
-  TrieNode* root_;
+  // frequent runes get small codes so that siblings pack densely
+  void CreateAlphabet(const vector<Unicode>& keys) {
+    unordered_map<Rune, size_t> freqs;
+    for (size_t i = 0; i < keys.size(); i++) {
+      for (Unicode::const_iterator it = keys[i].begin(); it != keys[i].end(); ++it) {
+        freqs[*it]++;
+      }
+    }
+    vector<pair<size_t, Rune> > runes;
+    runes.reserve(freqs.size());
+    for (unordered_map<Rune, size_t>::const_iterator it = freqs.begin(); it != freqs.end(); ++it) {
+      runes.push_back(make_pair(it->second, it->first));
+    }
+    sort(runes.begin(), runes.end(), [](const pair<size_t, Rune>& lhs, const pair<size_t, Rune>& rhs) {
+      return lhs.first != rhs.first ? lhs.first > rhs.first : lhs.second < rhs.second;
+    });
+    for (size_t i = 0; i < runes.size(); i++) {
+      AddCode(runes[i].second);
+    }
+  }
+
+  FlatArray<TrieUnit, LargePageAllocator<TrieUnit> > units_;
+  vector<const DictUnit*> values_;
+  FlatArray<uint32_t> bmpCodes_;
+  FlatArray<TrieRoot> roots_;
+  vector<TrieLink> links_; // empty unless BuildAutomaton() was called
+  FlatArray<TrieCode> supplementaryCodes_;
+  int32_t freeHead_;
+  uint32_t alphabetSize_;
 }; // class Trie
 } // namespace cppjieba
 
@@ -6,8 +6,17 @@
 #include <string>
 #include <vector>
 #include <ostream>
+#include <cstring>
+#include <cstddef>
+#include <cassert>
+#include <iterator>
 #include "limonp/LocalVector.hpp"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CPPJIEBA_HAVE_SSE2 1
+#endif
+
 namespace cppjieba {
 
 using std::string;
@@ -54,7 +63,180 @@ inline std::ostream& operator << (std::ostream& os, const RuneStr& r) {
 }
 
 typedef limonp::LocalVector<Rune> Unicode;
-typedef limonp::LocalVector<struct RuneStr> RuneStrArray;
+
+// The decoded runes of a text as two parallel arrays, the runes and their
+// byte offsets, 8 bytes a rune instead of the 20 of a RuneStr. The byte
+// length of a rune is the distance to the next offset and its unicode offset
+// is its index, so the runes must cover the text without gaps. The iterators
+// make up RuneStr values on the fly, rune scans read the packed runes only.
+class RuneStrArray {
+ public:
+  class const_iterator {
+   public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef RuneStr value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const RuneStr* pointer;
+    typedef RuneStr reference;
+
+    // what operator -> points to, the RuneStr lives in it
+    class Arrow {
+     public:
+      explicit Arrow(const RuneStr& value): value_(value) {
+      }
+      const RuneStr* operator -> () const {
+        return &value_;
+      }
+     private:
+      RuneStr value_;
+    }; // class Arrow
+
+    const_iterator(): rune_(NULL), owner_(NULL) {
+    }
+    const_iterator(const Rune* rune, const RuneStrArray* owner): rune_(rune), owner_(owner) {
+    }
+
+    RuneStr operator * () const {
+      return owner_->At(rune_);
+    }
+    Arrow operator -> () const {
+      return Arrow(owner_->At(rune_));
+    }
+    RuneStr operator [] (ptrdiff_t n) const {
+      return owner_->At(rune_ + n);
+    }
+    // the packed runes from here on
+    const Rune* RunePointer() const {
+      return rune_;
+    }
+
+    const_iterator& operator ++ () {
+      ++rune_;
+      return *this;
+    }
+    const_iterator operator ++ (int) {
+      const_iterator it = *this;
+      ++rune_;
+      return it;
+    }
+    const_iterator& operator -- () {
+      --rune_;
+      return *this;
+    }
+    const_iterator operator -- (int) {
+      const_iterator it = *this;
+      --rune_;
+      return it;
+    }
+    const_iterator& operator += (ptrdiff_t n) {
+      rune_ += n;
+      return *this;
+    }
+    const_iterator& operator -= (ptrdiff_t n) {
+      rune_ -= n;
+      return *this;
+    }
+    const_iterator operator + (ptrdiff_t n) const {
+      return const_iterator(rune_ + n, owner_);
+    }
+    const_iterator operator - (ptrdiff_t n) const {
+      return const_iterator(rune_ - n, owner_);
+    }
+    ptrdiff_t operator - (const const_iterator& other) const {
+      return rune_ - other.rune_;
+    }
+
+    bool operator == (const const_iterator& other) const {
+      return rune_ == other.rune_;
+    }
+    bool operator != (const const_iterator& other) const {
+      return rune_ != other.rune_;
+    }
+    bool operator < (const const_iterator& other) const {
+      return rune_ < other.rune_;
+    }
+    bool operator <= (const const_iterator& other) const {
+      return rune_ <= other.rune_;
+    }
+    bool operator > (const const_iterator& other) const {
+      return rune_ > other.rune_;
+    }
+    bool operator >= (const const_iterator& other) const {
+      return rune_ >= other.rune_;
+    }
+
+   private:
+    const Rune* rune_;
+    const RuneStrArray* owner_;
+  }; // class const_iterator
+
+  RuneStrArray() {
+    offsets_.push_back(0);
+  }
+
+  RuneStr operator [] (size_t i) const {
+    assert(i < size());
+    return At(runes_.begin() + i);
+  }
+  const_iterator begin() const {
+    return const_iterator(runes_.begin(), this);
+  }
+  const_iterator end() const {
+    return const_iterator(runes_.end(), this);
+  }
+  size_t size() const {
+    return runes_.size();
+  }
+  bool empty() const {
+    return runes_.empty();
+  }
+  const Rune* Runes() const {
+    return runes_.begin();
+  }
+
+  void clear() {
+    runes_.clear();
+    offsets_.clear();
+    offsets_.push_back(0);
+  }
+  void reserve(size_t size) {
+    runes_.reserve(size);
+    offsets_.reserve(size + 1);
+  }
+  // the next rune of the text, len bytes long
+  void Append(Rune rune, uint32_t len) {
+    runes_.push_back(rune);
+    offsets_.push_back(offsets_[offsets_.size() - 1] + len);
+  }
+  // the unicode offset and length of x are implied
+  void push_back(const RuneStr& x) {
+    if (runes_.empty()) {
+      offsets_[0] = x.offset;
+    }
+    assert(x.offset == offsets_[offsets_.size() - 1]);
+    Append(x.rune, x.len);
+  }
+
+ private:
+  RuneStr At(const Rune* rune) const {
+    size_t i = rune - runes_.begin();
+    return RuneStr(*rune, offsets_[i], offsets_[i + 1] - offsets_[i], uint32_t(i), 1);
+  }
+
+  limonp::LocalVector<Rune> runes_;
+  limonp::LocalVector<uint32_t> offsets_; // one more than the runes, the last one is where the text ends
+}; // class RuneStrArray
+
+inline std::ostream& operator << (std::ostream& os, const RuneStrArray& runes) {
+  if (runes.empty()) {
+    return os << "[]";
+  }
+  os << "[\"" << runes[0];
+  for (size_t i = 1; i < runes.size(); i++) {
+    os << "\", \"" << runes[i];
+  }
+  return os << "\"]";
+}
 
 // [left, right]
 struct WordRange {
@@ -142,23 +324,83 @@ inline RuneStrLite DecodeRuneInString(const char* str, size_t len) {
   return rp;
 }
 
-inline bool DecodeRunesInString(const char* s, size_t len, RuneStrArray& runes) {
+// length of the run of ASCII bytes s starts with, checked a block at a time
+inline size_t AsciiPrefixLength(const char* s, size_t len) {
+  size_t i = 0;
+#if defined(CPPJIEBA_HAVE_SSE2)
+  for (; i + 16 <= len; i += 16) {
+    if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)))) {
+      break;
+    }
+  }
+#else
+  for (; i + 8 <= len; i += 8) {
+    uint64_t block;
+    memcpy(&block, s + i, sizeof(block));
+    if (block & 0x8080808080808080ULL) {
+      break;
+    }
+  }
+#endif
+  while (i < len && !(s[i] & 0x80)) {
+    i++;
+  }
+  return i;
+}
+
+inline void AppendRune(RuneStrArray& runes, Rune rune, uint32_t, uint32_t len, uint32_t) {
+  runes.Append(rune, len);
+}
+
+inline void AppendRune(Unicode& unicode, Rune rune, uint32_t, uint32_t, uint32_t) {
+  unicode.push_back(rune);
+}
+
+// Looks at nothing, for decoding alone.
+struct IgnoreRune {
+  void operator()(Rune, uint32_t) const {
+  }
+}; // struct IgnoreRune
+
+// Runs of ASCII, common in mixed text, are found a block at a time and
+// skip the per rune decoding. visit(rune, index) is called for each rune
+// decoded, e.g. to find separators in the same pass.
+template <class RuneArray, class Visit>
+bool DecodeRunes(const char* s, size_t len, RuneArray& runes, Visit& visit) {
   runes.clear();
   runes.reserve(len / 2);
   for (uint32_t i = 0, j = 0; i < len;) {
+    if (!(s[i] & 0x80)) {
+      uint32_t end = i + uint32_t(AsciiPrefixLength(s + i, len - i));
+      for (; i < end; i++, j++) {
+        AppendRune(runes, uint8_t(s[i]), i, 1, j);
+        visit(uint8_t(s[i]), j);
+      }
+      continue;
+    }
     RuneStrLite rp = DecodeRuneInString(s + i, len - i);
     if (rp.len == 0) {
       runes.clear();
       return false;
     }
-    RuneStr x(rp.rune, i, rp.len, j, 1);
-    runes.push_back(x);
+    AppendRune(runes, rp.rune, i, rp.len, j);
+    visit(rp.rune, j);
     i += rp.len;
     ++j;
   }
   return true;
 }
 
+template <class RuneArray>
+bool DecodeRunes(const char* s, size_t len, RuneArray& runes) {
+  IgnoreRune ignore;
+  return DecodeRunes(s, len, runes, ignore);
+}
+
+inline bool DecodeRunesInString(const char* s, size_t len, RuneStrArray& runes) {
+  return DecodeRunes(s, len, runes);
+}
+
 inline bool DecodeRunesInString(const string& s, RuneStrArray& runes) {
   return DecodeRunesInString(s.c_str(), s.size(), runes);
 }
@@ -168,16 +410,7 @@ inline bool DecodeRunesInString(const std::string_view & s, RuneStrArray& runes)
 }
 
 inline bool DecodeRunesInString(const char* s, size_t len, Unicode& unicode) {
-  unicode.clear();
-  RuneStrArray runes;
-  if (!DecodeRunesInString(s, len, runes)) {
-    return false;
-  }
-  unicode.reserve(runes.size());
-  for (size_t i = 0; i < runes.size(); i++) {
-    unicode.push_back(runes[i].rune);
-  }
-  return true;
+  return DecodeRunes(s, len, unicode);
 }
 
 inline bool IsSingleWord(const string& str) {
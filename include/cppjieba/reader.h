@@ -17,6 +17,27 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// the host project may define these, the defaults let the header build alone
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#if !defined(HAVE_PREAD) && !defined(_MSC_VER)
+#define HAVE_PREAD 1
+#endif
 
 #ifdef _MSC_VER
 inline int PreadWrapper ( int iFD, void * pBuf, size_t tCount, int64_t iOff )
@@ -183,9 +204,106 @@ private:
 	}
 };
 
+// read-only mapping of a whole file, pages are shared with other processes mapping it
+class MappedFile_c
+{
+public:
+			MappedFile_c() = default;
+			~MappedFile_c() { Close(); }
+
+			MappedFile_c ( const MappedFile_c & ) = delete;
+	MappedFile_c & operator= ( const MappedFile_c & ) = delete;
+
+	bool Open ( const std::string & sName )
+	{
+		Close();
+
+	#ifdef _MSC_VER
+		HANDLE hFile = CreateFile ( sName.c_str(), GENERIC_READ, FILE_SHARE_DELETE | FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+		if ( hFile==INVALID_HANDLE_VALUE )
+			return false;
+
+		LARGE_INTEGER tSize;
+		if ( !GetFileSizeEx ( hFile, &tSize ) )
+		{
+			CloseHandle ( hFile );
+			return false;
+		}
+
+		// an empty file can not be mapped, it is read as no data
+		if ( !tSize.QuadPart )
+		{
+			CloseHandle ( hFile );
+			return true;
+		}
+
+		HANDLE hMapping = CreateFileMapping ( hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+		CloseHandle ( hFile );
+		if ( !hMapping )
+			return false;
+
+		const void * pData = MapViewOfFile ( hMapping, FILE_MAP_READ, 0, 0, 0 );
+		CloseHandle ( hMapping );
+		if ( !pData )
+			return false;
+
+		m_tSize = (size_t)tSize.QuadPart;
+	#else
+		int iFD = ::open ( sName.c_str(), O_RDONLY | O_BINARY, 0644 );
+		if ( iFD<0 )
+			return false;
+
+		struct stat tStat;
+		if ( fstat ( iFD, &tStat )<0 )
+		{
+			::close(iFD);
+			return false;
+		}
+
+		// an empty file can not be mapped, it is read as no data
+		if ( !tStat.st_size )
+		{
+			::close(iFD);
+			return true;
+		}
+
+		const void * pData = mmap ( NULL, (size_t)tStat.st_size, PROT_READ, MAP_SHARED, iFD, 0 );
+		::close(iFD);
+		if ( pData==MAP_FAILED )
+			return false;
+
+		m_tSize = (size_t)tStat.st_size;
+	#endif
+
+		m_pData = (const uint8_t *)pData;
+		return true;
+	}
+
+	void Close()
+	{
+		if ( !m_pData )
+			return;
+
+	#ifdef _MSC_VER
+		UnmapViewOfFile ( m_pData );
+	#else
+		munmap ( (void *)m_pData, m_tSize );
+	#endif
+		m_pData = nullptr;
+		m_tSize = 0;
+	}
+
+	const uint8_t * GetData() const { return m_pData; }
+	size_t GetSize() const { return m_tSize; }
+
+private:
+	const uint8_t * m_pData = nullptr;
+	size_t			m_tSize = 0;
+};
+
 } // namespace FileUtil
 
-bool SplitText ( char * szText, int iLen, char ** dTokens, int iRequiredTokens )
+inline bool SplitText ( char * szText, int iLen, char ** dTokens, int iRequiredTokens )
   {
     int iTokens = 0;
     const char * szEnd = szText + iLen;
@@ -0,0 +1,45 @@
+// Checks jieba::embedded of the CPPJIEBA_EMBED_DICT option against the text
+// files it was generated from.
+//
+// usage: embedded_test <dict> <hmm model> <idf> <stop words>
+#include <cstdio>
+#include "cppjieba/Jieba.hpp"
+#include "cppjieba/EmbeddedDict.hpp"
+
+using namespace std;
+using namespace cppjieba;
+
+int main(int argc, char** argv) {
+  if (argc != 5) {
+    fprintf(stderr, "usage: %s <dict> <hmm model> <idf> <stop words>\n", argv[0]);
+    return 1;
+  }
+  Jieba text(argv[1], argv[2], "", argv[3], argv[4]);
+
+  DictTrie dict(EMBEDDED_DICT_IMAGE.data, EMBEDDED_DICT_IMAGE.size);
+  HMMModel model(EMBEDDED_HMM_IMAGE.data, EMBEDDED_HMM_IMAGE.size);
+  Jieba embedded(&dict, &model, EMBEDDED_IDF.Text(), EMBEDDED_STOP_WORDS.Text());
+
+  const char* strs[] = {
+    "他来到了网易杭研大厦",
+    "我来自北京邮电大学。。。学号123456，用AK47",
+    "小明硕士毕业于中国科学院计算所，后在日本京都大学深造",
+  };
+  for (size_t i = 0; i < sizeof(strs)/sizeof(strs[0]); i++) {
+    vector<string> expected, actual;
+    text.Cut(strs[i], expected);
+    embedded.Cut(strs[i], actual);
+    if (expected.empty() || expected != actual) {
+      fprintf(stderr, "cut of %s differs\n", strs[i]);
+      return 1;
+    }
+    text.CutForSearch(strs[i], expected);
+    embedded.CutForSearch(strs[i], actual);
+    if (expected != actual) {
+      fprintf(stderr, "cut for search of %s differs\n", strs[i]);
+      return 1;
+    }
+  }
+  printf("embedded dictionary ok\n");
+  return 0;
+}
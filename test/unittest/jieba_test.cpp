@@ -131,3 +131,75 @@ TEST(JiebaTest, InsertUserWord) {
     ASSERT_EQ(res, "[{\"word\": \"iPhone6\", \"offset\": [6], \"weight\": 11.7392}, {\"word\": \"\xE4\xB8\x80\xE9\x83\xA8\", \"offset\": [0], \"weight\": 6.47592}]");
   }
 }
+
+TEST(JiebaTest, CutParallel) {
+  DictTrie dict("../test/testdata/extra_dict/jieba.dict.small.utf8", "../test/testdata/userdict.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  const char* idf = "一 1.0\n";
+  const char* stopWords = "的\n";
+  Jieba jieba(&dict, &model, TextSpan(idf, idf + strlen(idf)), TextSpan(stopWords, stopWords + strlen(stopWords)));
+  ifstream ifs("../test/testdata/weicheng.utf8");
+  string text((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+  ASSERT_GT(text.size(), 4 * MIN_PARALLEL_CUT_CHUNK_SIZE);
+
+  vector<Word> words, parallel;
+  jieba.Cut(text, words);
+  jieba.CutParallel(text, parallel, true, 4);
+  ASSERT_EQ(words.size(), parallel.size());
+  for (size_t i = 0; i < words.size(); i++) {
+    ASSERT_EQ(words[i].word, parallel[i].word);
+    ASSERT_EQ(words[i].offset, parallel[i].offset);
+    ASSERT_EQ(words[i].unicode_offset, parallel[i].unicode_offset);
+    ASSERT_EQ(words[i].unicode_length, parallel[i].unicode_length);
+  }
+  // too short to split
+  jieba.CutParallel("他来到了网易杭研大厦", parallel, true, 4);
+  jieba.Cut("他来到了网易杭研大厦", words);
+  ASSERT_EQ(words.size(), parallel.size());
+
+  // not UTF-8 in a middle chunk, no words at all like Cut()
+  text.insert(text.find('\n', text.size() / 2) + 1, "\xff");
+  jieba.Cut(text, words);
+  ASSERT_TRUE(words.empty());
+  jieba.CutParallel(text, parallel, true, 4);
+  ASSERT_TRUE(parallel.empty());
+}
+
+TEST(JiebaTest, CutMultiple) {
+  DictTrie dict("../test/testdata/extra_dict/jieba.dict.small.utf8", "../test/testdata/userdict.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  const char* idf = "一 1.0\n";
+  const char* stopWords = "的\n";
+  Jieba jieba(&dict, &model, TextSpan(idf, idf + strlen(idf)), TextSpan(stopWords, stopWords + strlen(stopWords)));
+  ifstream ifs("../test/testdata/weicheng.utf8");
+  string text((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+  text.resize(text.find('\n', 20000) + 1);
+  text += "小明硕士毕业于中国科学院计算所，后在日本京都大学深造";
+
+  CutContext ctx;
+  vector<Jieba::ModeWord> words;
+  jieba.CutMultiple(text, words, Jieba::CutModeMix | Jieba::CutModeAll | Jieba::CutModeSearch, ctx);
+  vector<Word> expected[3];
+  jieba.Cut(text, expected[0], ctx);
+  jieba.CutAll(text, expected[1], ctx);
+  jieba.CutForSearch(text, expected[2], ctx);
+  for (int mode = 0; mode < 3; mode++) {
+    vector<pair<uint32_t, string> > want, got;
+    for (size_t i = 0; i < expected[mode].size(); i++) {
+      want.push_back(make_pair(expected[mode][i].offset, expected[mode][i].word));
+    }
+    for (size_t i = 0; i < words.size(); i++) {
+      if (words[i].modes & (1 << mode)) {
+        got.push_back(make_pair(words[i].word.offset, words[i].word.word));
+      }
+    }
+    if (2 == mode) {
+      sort(want.begin(), want.end());
+      sort(got.begin(), got.end());
+    }
+    ASSERT_EQ(want, got) << "mode " << mode;
+  }
+
+  jieba.CutMultiple(text, words, Jieba::CutModeAll, ctx);
+  ASSERT_EQ(expected[1].size(), words.size());
+}
@@ -41,3 +41,37 @@ TEST(PreFilterTest, Test1) {
     ASSERT_EQ(res, expected);
   }
 }
+
+TEST(PreFilterTest, SeparatorSet) {
+  SeparatorSet symbols;
+  ASSERT_TRUE(symbols.insert(' '));
+  ASSERT_TRUE(symbols.insert(65292u)); // "，"
+  ASSERT_FALSE(symbols.insert(' '));
+  ASSERT_TRUE(symbols.Contains(' '));
+  ASSERT_TRUE(symbols.Contains(65292u));
+  ASSERT_FALSE(symbols.Contains('a'));
+  ASSERT_FALSE(symbols.Contains(65288u)); // "（" shares the first byte
+  ASSERT_FALSE(symbols.Contains(20320u)); // "你"
+
+  // separators at both ends and next to each other
+  string s = " 你好（a） ，，b ";
+  PreFilter filter(symbols, s);
+  vector<string> words;
+  while (filter.HasNext()) {
+    PreFilter::Range range = filter.Next();
+    words.push_back(GetStringFromRunes(s, range.begin, range.end - 1));
+  }
+  ASSERT_EQ(limonp::Join(words.begin(), words.end(), "/"), " /你好（a）/ /，/，/b/ ");
+
+  // the decoded rune counts, not its encoding: the overlong C0 AF is '/'
+  symbols.insert('/');
+  s = "a\xc0\xaf" "b";
+  PreFilter overlong(symbols, s);
+  words.clear();
+  while (overlong.HasNext()) {
+    PreFilter::Range range = overlong.Next();
+    words.push_back(GetStringFromRunes(s, range.begin, range.end - 1));
+  }
+  ASSERT_EQ(3u, words.size());
+  ASSERT_EQ("\xc0\xaf", words[1]);
+}
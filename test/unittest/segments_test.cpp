@@ -4,6 +4,7 @@
 #include "cppjieba/HMMSegment.hpp"
 #include "cppjieba/FullSegment.hpp"
 #include "cppjieba/QuerySegment.hpp"
+#include "cppjieba/StreamCutter.hpp"
 #include "gtest/gtest.h"
 
 using namespace cppjieba;
@@ -181,6 +182,163 @@ TEST(HMMSegmentTest, Test1) {
   }
 }
 
+TEST(HMMSegmentTest, Image) {
+  HMMModel text("../dict/hmm_model.utf8");
+  ASSERT_TRUE(text.SaveImage("hmm_model.image"));
+  HMMModel image("hmm_model.image");
+  HMMSegment textSegment(&text);
+  HMMSegment imageSegment(&image);
+  const char* strs[] = {"我来自北京邮电大学。。。学号123456", "他来到了网易杭研大厦", "小明硕士毕业于中国科学院计算所𠀀"};
+  for (size_t i = 0; i < sizeof(strs)/sizeof(strs[0]); i++) {
+    vector<string> expected, actual;
+    textSegment.Cut(strs[i], expected);
+    imageSegment.Cut(strs[i], actual);
+    ASSERT_EQ(expected, actual);
+  }
+}
+
+TEST(HMMSegmentTest, EmitProbs) {
+  HMMModel model("../dict/hmm_model.utf8");
+  const Rune runes[] = {25105u, 0x20000u, 0x10ffffu}; // "我" and unknown ones out of the BMP
+  for (size_t i = 0; i < sizeof(runes)/sizeof(runes[0]); i++) {
+    const double* probs = model.GetEmitProbs(runes[i]);
+    for (size_t y = 0; y < HMMModel::STATUS_SUM; y++) {
+      ASSERT_EQ(model.GetEmitProb(y, runes[i], MIN_DOUBLE), probs[y]);
+      // the unknown states keep the default value
+      ASSERT_EQ(probs[y] == MIN_DOUBLE ? 1.0 : probs[y], model.GetEmitProb(y, runes[i], 1.0));
+    }
+  }
+  ASSERT_EQ(MIN_DOUBLE, model.GetEmitProbs(0x10ffffu)[HMMModel::B]);
+
+  for (size_t y = 0; y < HMMModel::STATUS_SUM; y++) {
+    EmitProbMap mp = model.GetEmitProbMap(y);
+    ASSERT_FALSE(mp.empty());
+    for (EmitProbMap::const_iterator it = mp.begin(); it != mp.end(); ++it) {
+      ASSERT_EQ(it->second, model.GetEmitProb(y, it->first, 1.0));
+    }
+  }
+}
+
+TEST(MixSegmentTest, SharedImages) {
+  DictTrie text("../test/testdata/extra_dict/jieba.dict.small.utf8", "../test/testdata/userdict.utf8");
+  ASSERT_TRUE(text.SaveImage("dict.image"));
+  HMMModel model("../dict/hmm_model.utf8");
+  ASSERT_TRUE(model.SaveImage("hmm_model.image"));
+
+  DictTrie dictImage("dict.image");
+  HMMModel modelImage("hmm_model.image");
+  MixSegment expected(&text, &model);
+  MixSegment first(&dictImage, &modelImage);
+  MixSegment second(&dictImage, &modelImage);
+  const char* str = "令狐冲是云计算行业的专家，他来到了网易杭研大厦";
+  vector<string> words, firstWords, secondWords;
+  expected.Cut(str, words);
+  first.Cut(str, firstWords);
+  second.Cut(str, secondWords);
+  ASSERT_EQ(words, firstWords);
+  ASSERT_EQ(words, secondWords);
+}
+
+// aligned like a mapped file
+static void ReadImage(const string& path, vector<uint64_t>& buffer, size_t& size) {
+  ifstream ifs(path.c_str(), ios::binary | ios::ate);
+  size = size_t(ifs.tellg());
+  buffer.resize(size / sizeof(uint64_t) + 1);
+  ifs.seekg(0);
+  ifs.read(reinterpret_cast<char*>(buffer.data()), size);
+}
+
+TEST(MixSegmentTest, MemoryImages) {
+  DictTrie text("../test/testdata/extra_dict/jieba.dict.small.utf8", "../test/testdata/userdict.utf8");
+  ASSERT_TRUE(text.SaveImage("dict.image"));
+  HMMModel model("../dict/hmm_model.utf8");
+  ASSERT_TRUE(model.SaveImage("hmm_model.image"));
+
+  vector<uint64_t> dictBuffer, modelBuffer;
+  size_t dictSize = 0, modelSize = 0;
+  ReadImage("dict.image", dictBuffer, dictSize);
+  ReadImage("hmm_model.image", modelBuffer, modelSize);
+  DictTrie dictImage(dictBuffer.data(), dictSize);
+  HMMModel modelImage(modelBuffer.data(), modelSize);
+  MixSegment expected(&text, &model);
+  MixSegment actual(&dictImage, &modelImage);
+  const char* str = "令狐冲是云计算行业的专家，他来到了网易杭研大厦";
+  vector<string> words, actualWords;
+  expected.Cut(str, words);
+  actual.Cut(str, actualWords);
+  ASSERT_EQ(words, actualWords);
+}
+
+static bool ReadFileToString(const string& path, string& text) {
+  ifstream ifs(path.c_str(), ios::binary);
+  text.assign(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+  return ifs.is_open();
+}
+
+TEST(MixSegmentTest, MemoryText) {
+  string dictText, modelText;
+  ASSERT_TRUE(ReadFileToString("../test/testdata/extra_dict/jieba.dict.small.utf8", dictText));
+  ASSERT_TRUE(ReadFileToString("../dict/hmm_model.utf8", modelText));
+  DictTrie dict(dictText.data(), dictText.size());
+  HMMModel model(modelText.data(), modelText.size());
+  dictText.clear();
+  modelText.clear();
+  const char* userDict = "云计算\n蓝翔 nz\n区块链 10 nz\n";
+  dict.LoadUserDict(TextSpan(userDict, userDict + strlen(userDict)));
+
+  DictTrie fileDict("../test/testdata/extra_dict/jieba.dict.small.utf8", "../test/testdata/userdict.utf8");
+  HMMModel fileModel("../dict/hmm_model.utf8");
+  MixSegment expected(&fileDict, &fileModel);
+  MixSegment actual(&dict, &model);
+  const char* str = "令狐冲是云计算行业的专家，他来到了网易杭研大厦";
+  vector<string> words, actualWords;
+  expected.Cut(str, words);
+  actual.Cut(str, actualWords);
+  ASSERT_EQ(words, actualWords);
+}
+
+TEST(MixSegmentTest, Stream) {
+  DictTrie dict("../test/testdata/extra_dict/jieba.dict.small.utf8", "../test/testdata/userdict.utf8");
+  HMMModel model("../dict/hmm_model.utf8");
+  MixSegment segment(&dict, &model);
+  string text;
+  ASSERT_TRUE(ReadFileToString("../test/testdata/weicheng.utf8", text));
+  text.resize(text.find('\n', 30000) + 1);
+  size_t separated = text.size();
+  // a line without any separator is cut at the chunk size
+  text += string(100, 'a') + "令狐冲是云计算行业的专家";
+
+  vector<Word> words, streamed;
+  segment.Cut(text, words);
+  StreamCutter cutter(segment.GetSeparators(), [&segment](const std::string_view& chunk, vector<Word>& res) {
+    segment.Cut(chunk, res);
+  }, [&streamed](const vector<Word>& res) {
+    streamed.insert(streamed.end(), res.begin(), res.end());
+  }, 256);
+  // pieces of 7 bytes split the runes
+  for (size_t i = 0; i < text.size(); i += 7) {
+    cutter.Feed(text.data() + i, min<size_t>(7, text.size() - i));
+  }
+  cutter.Finish();
+
+  string joined;
+  for (size_t i = 0; i < streamed.size(); i++) {
+    ASSERT_EQ(joined.size(), streamed[i].offset);
+    joined += streamed[i].word;
+  }
+  ASSERT_EQ(text, joined);
+  // the same words up to the line without separators
+  size_t n = 0;
+  while (n < words.size() && words[n].offset < separated) {
+    ASSERT_EQ(words[n].word, streamed[n].word);
+    ASSERT_EQ(words[n].offset, streamed[n].offset);
+    ASSERT_EQ(words[n].unicode_offset, streamed[n].unicode_offset);
+    ASSERT_EQ(words[n].unicode_length, streamed[n].unicode_length);
+    n++;
+  }
+  ASSERT_GT(n, 5000u);
+}
+
 TEST(FullSegment, Test1) {
   FullSegment segment("../test/testdata/extra_dict/jieba.dict.small.utf8");
   vector<string> words;
@@ -245,6 +403,32 @@ TEST(QuerySegment, Test2) {
 
 }
 
+TEST(MPSegmentTest, FusedDP) {
+  const char* dictPath = "../test/testdata/extra_dict/jieba.dict.small.utf8";
+  const char* userDictPath = "../test/testdata/userdict.utf8";
+  // the automaton still builds the DAG, the others cut along the walk
+  DictTrie automaton(dictPath, userDictPath, DictTrie::WordWeightMedian, DictTrie::DagByAutomaton);
+  DictTrie trie(dictPath, userDictPath);
+  DictTrie dawg(dictPath, userDictPath, DictTrie::WordWeightMedian, DictTrie::DagByTrieWalk, DictTrie::StorageDawg);
+  DictTrie base(dictPath);
+  DictTrie overlay(&base, userDictPath);
+  MPSegment expected(&automaton);
+  MPSegment segments[] = {MPSegment(&trie), MPSegment(&dawg), MPSegment(&overlay)};
+
+  string text;
+  ASSERT_TRUE(ReadFileToString("../test/testdata/weicheng.utf8", text));
+  text.resize(text.find('\n', 100000) + 1);
+  vector<Word> words, actual;
+  expected.Cut(text, words);
+  for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
+    segments[i].Cut(text, actual);
+    ASSERT_EQ(words.size(), actual.size());
+    for (size_t j = 0; j < words.size(); j++) {
+      ASSERT_EQ(words[j].word, actual[j].word);
+    }
+  }
+}
+
 TEST(MPSegmentTest, Unicode32) {
   string s("天气很好，🙋 我们去郊游。");
   vector<string> words;
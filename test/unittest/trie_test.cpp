@@ -1,6 +1,9 @@
 #include "cppjieba/DictTrie.hpp"
 #include "cppjieba/MPSegment.hpp"
 #include "gtest/gtest.h"
+#include <thread>
+#include <atomic>
+#include <fstream>
 
 using namespace cppjieba;
 
@@ -20,6 +23,73 @@ TEST(TrieTest, Construct) {
   Trie trie(keys, values);
 }
 
+TEST(TrieTest, InsertAndDelete) {
+  vector<Unicode> keys;
+  vector<const DictUnit*> values;
+  DictUnit units[3];
+  keys.push_back(DecodeRunesInString("北京"));
+  values.push_back(&units[0]);
+  keys.push_back(DecodeRunesInString("北京大学"));
+  values.push_back(&units[1]);
+  Trie trie(keys, values);
+
+  // siblings of existing states force them to be moved around
+  const char* words[] = {"北海", "北大", "北方", "北京人", "南京", "𠀀北"};
+  for (size_t i = 0; i < sizeof(words)/sizeof(words[0]); i++) {
+    trie.InsertNode(DecodeRunesInString(words[i]), &units[2]);
+  }
+  RuneStrArray runes;
+  for (size_t i = 0; i < sizeof(words)/sizeof(words[0]); i++) {
+    ASSERT_TRUE(DecodeRunesInString(string(words[i]), runes));
+    ASSERT_EQ(&units[2], trie.Find(runes.begin(), runes.end()));
+  }
+  ASSERT_TRUE(DecodeRunesInString(string("北京大学"), runes));
+  ASSERT_EQ(&units[1], trie.Find(runes.begin(), runes.end()));
+
+  trie.DeleteNode(DecodeRunesInString("北京"), NULL);
+  ASSERT_TRUE(DecodeRunesInString(string("北京"), runes));
+  ASSERT_TRUE(trie.Find(runes.begin(), runes.end()) == NULL);
+  ASSERT_TRUE(DecodeRunesInString(string("北京大学"), runes));
+  ASSERT_EQ(&units[1], trie.Find(runes.begin(), runes.end()));
+}
+
+TEST(TrieTest, ImageValidation) {
+  vector<Unicode> keys;
+  vector<const DictUnit*> values;
+  DictUnit units[3];
+  const char* words[] = {"北京", "北京大学", "𠀀北"};
+  for (size_t i = 0; i < sizeof(words)/sizeof(words[0]); i++) {
+    keys.push_back(DecodeRunesInString(words[i]));
+    values.push_back(&units[i]);
+  }
+  Trie trie(keys, values);
+  TrieImage image;
+  trie.GetImage(image);
+  size_t valueCount = trie.GetValues().size();
+  ASSERT_TRUE(Trie::IsValidImage(image, valueCount));
+  ASSERT_FALSE(Trie::IsValidImage(image, valueCount - 1));
+
+  // a state out of the units, e.g. of a truncated units section
+  vector<TrieRoot> roots(image.roots, image.roots + 0x10000);
+  TrieImage broken = image;
+  broken.roots = roots.data();
+  roots[DecodeRunesInString("北")[0]].state = int32_t(image.unitCount);
+  ASSERT_FALSE(Trie::IsValidImage(broken, valueCount));
+
+  vector<TrieUnit> brokenUnits(image.units, image.units + image.unitCount);
+  broken = image;
+  broken.units = brokenUnits.data();
+  for (size_t i = 1; i < brokenUnits.size(); i++) {
+    if (brokenUnits[i].check >= 0) {
+      brokenUnits[i].check = int32_t(brokenUnits.size());
+      break;
+    }
+  }
+  ASSERT_FALSE(Trie::IsValidImage(broken, valueCount));
+  broken.unitCount = 0;
+  ASSERT_FALSE(Trie::IsValidImage(broken, valueCount));
+}
+
 TEST(DictTrieTest, NewAndDelete) {
   DictTrie * trie;
   trie = new DictTrie(DICT_FILE);
@@ -41,10 +111,10 @@ TEST(DictTrieTest, Test1) {
   //s2 << (*trie.Find(uni.begin(), uni.end()));
   const DictUnit* du = trie.Find(uni.begin(), uni.end());
   ASSERT_TRUE(du != NULL);
-  ASSERT_EQ(2u, du->word.size());
-  ASSERT_EQ(26469u, du->word[0]);
-  ASSERT_EQ(21040u, du->word[1]);
-  ASSERT_EQ("v", du->tag);
+  ASSERT_EQ(2u, du->wordLength);
+  ASSERT_EQ(26469u, trie.GetWord(du)[0]);
+  ASSERT_EQ(21040u, trie.GetWord(du)[1]);
+  ASSERT_EQ("v", trie.GetTag(du));
   ASSERT_NEAR(-8.870, du->weight, 0.001);
 
   //EXPECT_EQ("[\"26469\", \"21040\"] v -8.870", s2);
@@ -81,14 +151,14 @@ TEST(DictTrieTest, UserDict) {
   ASSERT_TRUE(DecodeRunesInString(word, unicode));
   unit = trie.Find(unicode.begin(), unicode.end());
   ASSERT_TRUE(unit != NULL);
-  ASSERT_EQ(unit->tag, "nz");
+  ASSERT_EQ(trie.GetTag(unit), "nz");
   ASSERT_NEAR(unit->weight, -14.100, 0.001);
 
   word = "区块链";
   ASSERT_TRUE(DecodeRunesInString(word, unicode));
   unit = trie.Find(unicode.begin(), unicode.end());
   ASSERT_TRUE(unit != NULL);
-  ASSERT_EQ(unit->tag, "nz");
+  ASSERT_EQ(trie.GetTag(unit), "nz");
   ASSERT_NEAR(unit->weight, -15.6478, 0.001);
 }
 
@@ -102,6 +172,30 @@ TEST(DictTrieTest, UserDictWithMaxWeight) {
   ASSERT_NEAR(unit->weight, -2.975, 0.001);
 }
 
+TEST(DictTrieTest, Lattice) {
+  DictTrie walk(DICT_FILE, "../test/testdata/userdict.utf8");
+  DictTrie automaton(DICT_FILE, "../test/testdata/userdict.utf8", DictTrie::WordWeightMedian, DictTrie::DagByAutomaton);
+  DictTrie* tries[] = {&walk, &automaton};
+  for (size_t k = 0; k < sizeof(tries) / sizeof(tries[0]); k++) {
+    string word = "清华大学";
+    cppjieba::RuneStrArray unicode;
+    ASSERT_TRUE(DecodeRunesInString(word, unicode));
+    DagLattice lattice;
+    tries[k]->Find(unicode.begin(), unicode.end(), lattice);
+
+    // 清 清华 清华大学 / 华 华大 / 大 大学 / 学
+    uint32_t offsets[] = {0, 3, 5, 7, 8};
+    uint32_t ends[] = {0, 1, 3, 1, 2, 2, 3, 3};
+    ASSERT_EQ(4u, lattice.size());
+    ASSERT_EQ(vector<uint32_t>(offsets, offsets + 5), lattice.offsets);
+    ASSERT_EQ(8u, lattice.edges.size());
+    for (size_t i = 0; i < lattice.edges.size(); i++) {
+      ASSERT_EQ(ends[i], lattice.edges[i].end);
+    }
+    ASSERT_EQ(2u, lattice.EdgeCount(1));
+  }
+}
+
 TEST(DictTrieTest, Dag) {
   DictTrie trie(DICT_FILE, "../test/testdata/userdict.utf8");
 
@@ -175,3 +269,267 @@ TEST(DictTrieTest, Dag) {
     }
   }
 }
+
+TEST(MappedFileTest, Empty) {
+  { ofstream ofs("empty.utf8", ios::trunc); }
+  FileUtil::MappedFile_c file;
+  ASSERT_TRUE(file.Open("empty.utf8"));
+  ASSERT_EQ(0u, file.GetSize());
+  const char* data = reinterpret_cast<const char*>(file.GetData());
+  vector<TextSpan> spans;
+  SplitIntoLineChunks(data, file.GetSize(), spans);
+  size_t lines = 0;
+  for (size_t i = 0; i < spans.size(); i++) {
+    TextSpan line;
+    for (const char* cursor = spans[i].begin; NextLine(cursor, spans[i].end, line);) {
+      lines++;
+    }
+  }
+  ASSERT_EQ(0u, lines);
+  ASSERT_FALSE(file.Open("no_such_file.utf8"));
+}
+
+TEST(DictTrieTest, Image) {
+  const char* const image_file = "dict.image";
+  DictTrie text(DICT_FILE, "../test/testdata/userdict.utf8");
+  ASSERT_TRUE(text.SaveImage(image_file));
+  DictTrie image(image_file);
+
+  ASSERT_EQ(text.GetMinWeight(), image.GetMinWeight());
+  const char* words[] = {"来到", "清华大学", "云计算", "蓝翔", "区块链", "不存在的词"};
+  RuneStrArray runes;
+  for (size_t i = 0; i < sizeof(words)/sizeof(words[0]); i++) {
+    ASSERT_TRUE(DecodeRunesInString(string(words[i]), runes));
+    const DictUnit* expected = text.Find(runes.begin(), runes.end());
+    const DictUnit* actual = image.Find(runes.begin(), runes.end());
+    ASSERT_EQ(expected == NULL, actual == NULL);
+    if (expected != NULL) {
+      Unicode expectedWord = text.GetWord(expected);
+      Unicode actualWord = image.GetWord(actual);
+      ASSERT_EQ(expectedWord.size(), actualWord.size());
+      ASSERT_TRUE(equal(expectedWord.begin(), expectedWord.end(), actualWord.begin()));
+      ASSERT_EQ(text.GetTag(expected), image.GetTag(actual));
+      ASSERT_EQ(expected->weight, actual->weight);
+    }
+  }
+  ASSERT_TRUE(DecodeRunesInString(string("北京邮电大学长江大桥"), runes));
+  vector<struct Dag> expected, actual;
+  text.Find(runes.begin(), runes.end(), expected);
+  image.Find(runes.begin(), runes.end(), actual);
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    ASSERT_EQ(expected[i].nexts.size(), actual[i].nexts.size());
+  }
+
+  // inserting into a mapped trie works on a private copy
+  ASSERT_TRUE(image.InsertUserWord("一个不存在的词"));
+  ASSERT_TRUE(image.Find("一个不存在的词"));
+  ASSERT_TRUE(image.Find("来到"));
+}
+
+TEST(DictTrieTest, Automaton) {
+  DictTrie walk(DICT_FILE, "../test/testdata/userdict.utf8");
+  DictTrie automaton(DICT_FILE, "../test/testdata/userdict.utf8", DictTrie::WordWeightMedian, DictTrie::DagByAutomaton);
+  ASSERT_TRUE(walk.InsertUserWord("京大学生"));
+  ASSERT_TRUE(automaton.InsertUserWord("京大学生"));
+
+  const char* sentences[] = {"北京邮电大学长江大桥", "南京市长江大桥上的北京大学生", "我来到北京清华大学"};
+  size_t max_word_lens[] = {MAX_WORD_LENGTH, 3, 1};
+  for (size_t i = 0; i < sizeof(sentences)/sizeof(sentences[0]); i++) {
+    RuneStrArray runes;
+    ASSERT_TRUE(DecodeRunesInString(string(sentences[i]), runes));
+    for (size_t k = 0; k < sizeof(max_word_lens)/sizeof(max_word_lens[0]); k++) {
+      vector<struct Dag> expected, actual;
+      walk.Find(runes.begin(), runes.end(), expected, max_word_lens[k]);
+      automaton.Find(runes.begin(), runes.end(), actual, max_word_lens[k]);
+      ASSERT_EQ(expected.size(), actual.size());
+      for (size_t j = 0; j < expected.size(); j++) {
+        ASSERT_EQ(expected[j].nexts.size(), actual[j].nexts.size());
+        for (size_t n = 0; n < expected[j].nexts.size(); n++) {
+          ASSERT_EQ(expected[j].nexts[n].first, actual[j].nexts[n].first);
+          ASSERT_EQ(expected[j].nexts[n].second == NULL, actual[j].nexts[n].second == NULL);
+          if (expected[j].nexts[n].second != NULL) {
+            ASSERT_EQ(expected[j].nexts[n].second->weight, actual[j].nexts[n].second->weight);
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(DictTrieTest, ConcurrentUpdate) {
+  DictTrie trie(DICT_FILE);
+  RuneStrArray runes;
+  ASSERT_TRUE(DecodeRunesInString(string("我来到北京清华大学"), runes));
+  vector<struct Dag> expected;
+  trie.Find(runes.begin(), runes.end(), expected);
+
+  // the words of the sentence are not touched, so readers always see them
+  atomic<bool> done(false);
+  atomic<size_t> mismatches(0);
+  vector<thread> readers;
+  for (size_t i = 0; i < 4; i++) {
+    readers.push_back(thread([&]() {
+      while (!done.load()) {
+        vector<struct Dag> dags;
+        trie.Find(runes.begin(), runes.end(), dags);
+        for (size_t j = 0; j < dags.size(); j++) {
+          if (dags[j].nexts.size() != expected[j].nexts.size()) {
+            mismatches++;
+          }
+        }
+        if (NULL == trie.Find(runes.begin() + 3, runes.begin() + 5) || trie.GetTag(trie.Find(runes.begin() + 3, runes.begin() + 5)) != "ns") {
+          mismatches++;
+        }
+      }
+    }));
+  }
+  for (size_t i = 0; i < 100; i++) {
+    string word = "并发词" + to_string(i);
+    ASSERT_TRUE(trie.InsertUserWord(word, "tag" + to_string(i % 7)));
+    ASSERT_TRUE(trie.Find(word));
+    if (i % 2) {
+      ASSERT_TRUE(trie.DeleteUserWord(word));
+      ASSERT_FALSE(trie.Find(word));
+    }
+  }
+  done = true;
+  for (size_t i = 0; i < readers.size(); i++) {
+    readers[i].join();
+  }
+  ASSERT_EQ(0u, mismatches.load());
+  ASSERT_TRUE(trie.Find("并发词98"));
+  ASSERT_FALSE(trie.Find("并发词99"));
+}
+
+TEST(DictTrieTest, LoadUserDictAtRuntime) {
+  DictTrie trie(DICT_FILE);
+  ASSERT_FALSE(trie.Find("韩玉鉴赏"));
+  ASSERT_TRUE(trie.InsertUserWord("同一个世界"));
+  ASSERT_TRUE(trie.DeleteUserWord("来到"));
+
+  vector<string> lines;
+  lines.push_back("区块链 10 nz");
+  lines.push_back("");
+  lines.push_back("A");
+  trie.LoadUserDict(lines);
+  ASSERT_TRUE(trie.Find("区块链"));
+  ASSERT_TRUE(trie.IsUserDictSingleChineseWord(DecodeRunesInString("A")[0]));
+  trie.LoadUserDictAsync("../test/testdata/userdict.utf8").get();
+  ASSERT_TRUE(trie.Find("韩玉鉴赏"));
+
+  // the words present before are kept, deleted ones stay deleted
+  ASSERT_TRUE(trie.Find("同一个世界"));
+  ASSERT_TRUE(trie.Find("北京"));
+  ASSERT_FALSE(trie.Find("来到"));
+  RuneStrArray runes;
+  ASSERT_TRUE(DecodeRunesInString(string("区块链"), runes));
+  ASSERT_EQ("nz", trie.GetTag(trie.Find(runes.begin(), runes.end())));
+}
+
+TEST(DictTrieTest, Dawg) {
+  DictTrie trie(DICT_FILE, "../test/testdata/userdict.utf8");
+  DictTrie dawg(DICT_FILE, "../test/testdata/userdict.utf8", DictTrie::WordWeightMedian, DictTrie::DagByTrieWalk, DictTrie::StorageDawg);
+  ASSERT_TRUE(trie.InsertUserWord("京大学生"));
+  ASSERT_TRUE(dawg.InsertUserWord("京大学生"));
+  ASSERT_TRUE(trie.DeleteUserWord("长江大桥"));
+  ASSERT_TRUE(dawg.DeleteUserWord("长江大桥"));
+  ASSERT_FALSE(dawg.Find("长江大桥"));
+  ASSERT_TRUE(dawg.Find("云计算"));
+  ASSERT_FALSE(dawg.SaveImage("dawg.img"));
+
+  const char* sentences[] = {"北京邮电大学长江大桥", "南京市长江大桥上的北京大学生", "我来到北京清华大学"};
+  for (size_t i = 0; i < sizeof(sentences)/sizeof(sentences[0]); i++) {
+    RuneStrArray runes;
+    ASSERT_TRUE(DecodeRunesInString(string(sentences[i]), runes));
+    vector<struct Dag> expected, actual;
+    trie.Find(runes.begin(), runes.end(), expected);
+    dawg.Find(runes.begin(), runes.end(), actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t j = 0; j < expected.size(); j++) {
+      ASSERT_EQ(expected[j].nexts.size(), actual[j].nexts.size());
+      for (size_t n = 0; n < expected[j].nexts.size(); n++) {
+        ASSERT_EQ(expected[j].nexts[n].first, actual[j].nexts[n].first);
+        ASSERT_EQ(expected[j].nexts[n].second == NULL, actual[j].nexts[n].second == NULL);
+        if (expected[j].nexts[n].second != NULL) {
+          ASSERT_EQ(expected[j].nexts[n].second->weight, actual[j].nexts[n].second->weight);
+        }
+      }
+    }
+  }
+}
+
+TEST(DictTrieTest, MemoryStats) {
+  DictTrie trie(DICT_FILE, "../test/testdata/userdict.utf8");
+  DictTrie dawg(DICT_FILE, "../test/testdata/userdict.utf8", DictTrie::WordWeightMedian, DictTrie::DagByTrieWalk, DictTrie::StorageDawg);
+  MemoryStats trieStats, dawgStats;
+  trie.GetMemoryStats(trieStats);
+  dawg.GetMemoryStats(dawgStats);
+
+  ASSERT_GT(trieStats.TotalBytes(false), 0u);
+  ASSERT_EQ(0u, trieStats.TotalBytes(true));
+  ASSERT_GT(trieStats.trieStates, 0u);
+  size_t states = 0;
+  for (size_t i = 0; i < trieStats.trieDepths.size(); i++) {
+    states += trieStats.trieDepths[i];
+  }
+  ASSERT_EQ(trieStats.trieStates, states);
+  ASSERT_EQ(1u, trieStats.trieDepths[0]);
+
+  ASSERT_LT(dawgStats.trieStates, trieStats.trieStates);
+  ASSERT_LT(dawgStats.TotalBytes(false), trieStats.TotalBytes(false));
+}
+
+TEST(DictTrieTest, Overlay) {
+  DictTrie base(DICT_FILE);
+  DictTrie overlay(&base, "../test/testdata/userdict.utf8");
+  DictTrie merged(DICT_FILE, "../test/testdata/userdict.utf8");
+  ASSERT_FALSE(base.Find("云计算"));
+  ASSERT_TRUE(overlay.Find("云计算"));
+  ASSERT_TRUE(overlay.Find("北京"));
+
+  ASSERT_TRUE(overlay.InsertUserWord("京大学生", "nz"));
+  ASSERT_TRUE(merged.InsertUserWord("京大学生", "nz"));
+  ASSERT_FALSE(base.Find("京大学生"));
+  ASSERT_TRUE(base.InsertUserWord("长江大", "n"));
+  ASSERT_TRUE(merged.InsertUserWord("长江大", "n"));
+  ASSERT_TRUE(overlay.Find("长江大"));
+
+  RuneStrArray runes;
+  ASSERT_TRUE(DecodeRunesInString(string("京大学生"), runes));
+  const DictUnit* unit = overlay.Find(runes.begin(), runes.end());
+  ASSERT_TRUE(unit != NULL);
+  ASSERT_EQ("nz", overlay.GetTag(unit));
+  ASSERT_EQ(4u, overlay.GetWord(unit).size());
+  ASSERT_TRUE(DecodeRunesInString(string("长江大"), runes));
+  unit = overlay.Find(runes.begin(), runes.end());
+  ASSERT_TRUE(unit != NULL);
+  ASSERT_EQ("n", overlay.GetTag(unit));
+  ASSERT_EQ(3u, overlay.GetWord(unit).size());
+
+  const char* sentences[] = {"北京邮电大学长江大桥", "南京市长江大桥上的北京大学生", "我在云计算区块链蓝翔"};
+  for (size_t i = 0; i < sizeof(sentences)/sizeof(sentences[0]); i++) {
+    ASSERT_TRUE(DecodeRunesInString(string(sentences[i]), runes));
+    vector<struct Dag> expected, actual;
+    merged.Find(runes.begin(), runes.end(), expected);
+    overlay.Find(runes.begin(), runes.end(), actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t j = 0; j < expected.size(); j++) {
+      ASSERT_EQ(expected[j].nexts.size(), actual[j].nexts.size());
+      for (size_t n = 0; n < expected[j].nexts.size(); n++) {
+        ASSERT_EQ(expected[j].nexts[n].first, actual[j].nexts[n].first);
+        ASSERT_EQ(expected[j].nexts[n].second == NULL, actual[j].nexts[n].second == NULL);
+        if (expected[j].nexts[n].second != NULL) {
+          ASSERT_EQ(expected[j].nexts[n].second->weight, actual[j].nexts[n].second->weight);
+          ASSERT_EQ(merged.GetTag(expected[j].nexts[n].second), overlay.GetTag(actual[j].nexts[n].second));
+        }
+      }
+    }
+  }
+
+  MemoryStats baseStats, overlayStats;
+  base.GetMemoryStats(baseStats);
+  overlay.GetMemoryStats(overlayStats);
+  ASSERT_LT(overlayStats.TotalBytes(false), 16u * 1024);
+  ASSERT_LT(overlayStats.TotalBytes(false) * 10, baseStats.TotalBytes(false));
+}
@@ -41,3 +41,57 @@ TEST(UnicodeTest, Rand) {
     DecodeRunesInString(s, runes);
   }
 }
+
+TEST(UnicodeTest, AsciiRuns) {
+  string s = "iPhone6 and the quick brown fox 你好 jumps over the lazy dog, 世界!";
+  RuneStrArray runes;
+  Unicode unicode;
+  ASSERT_TRUE(DecodeRunesInString(s, runes));
+  ASSERT_TRUE(DecodeRunesInString(s, unicode));
+  ASSERT_EQ(runes.size(), unicode.size());
+  ASSERT_EQ(s.size() - 4 * 2, runes.size());
+  uint32_t offset = 0;
+  for (size_t i = 0; i < runes.size(); i++) {
+    ASSERT_EQ(offset, runes[i].offset);
+    ASSERT_EQ(i, runes[i].unicode_offset);
+    ASSERT_EQ(1u, runes[i].unicode_length);
+    ASSERT_EQ(runes[i].rune, unicode[i]);
+    if (runes[i].rune < 0x80) {
+      ASSERT_EQ(1u, runes[i].len);
+      ASSERT_EQ(s[offset], char(runes[i].rune));
+    } else {
+      ASSERT_EQ(3u, runes[i].len);
+    }
+    offset += runes[i].len;
+  }
+
+  s.append(40, 'a');
+  s.push_back('\x80');
+  ASSERT_FALSE(DecodeRunesInString(s, runes));
+  ASSERT_FALSE(DecodeRunesInString(s, unicode));
+}
+
+TEST(UnicodeTest, RuneStrArray) {
+  RuneStrArray runes;
+  runes.push_back(RuneStr(0x4f60, 6, 3));
+  runes.push_back(RuneStr('a', 9, 1));
+  runes.push_back(RuneStr(0x20000, 10, 4));
+  ASSERT_EQ(3u, runes.size());
+  ASSERT_EQ(Rune('a'), runes.Runes()[1]);
+
+  RuneStrArray::const_iterator it = runes.begin() + 2;
+  ASSERT_EQ(2, it - runes.begin());
+  ASSERT_EQ(Rune(0x20000), it->rune);
+  ASSERT_EQ(10u, it->offset);
+  ASSERT_EQ(4u, it->len);
+  ASSERT_EQ(2u, (*it).unicode_offset);
+  ASSERT_EQ(1u, (*it).unicode_length);
+  ASSERT_EQ(6u, (--it - 1)->offset);
+  ASSERT_TRUE(runes.begin() < it && it + 2 == runes.end());
+
+  string s = "abcdef你a𠀀";
+  Word word = GetWordFromRunes(s, runes.begin(), runes.begin() + 2);
+  ASSERT_EQ("你a𠀀", word.word);
+  ASSERT_EQ(0u, word.unicode_offset);
+  ASSERT_EQ(3u, word.unicode_length);
+}
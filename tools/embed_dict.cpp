@@ -0,0 +1,71 @@
+// Generates the source of the jieba::embedded library, see EmbeddedDict.hpp:
+// the dictionary and the HMM model become images, the IDF table and the stop
+// words are kept as text.
+//
+// usage: embed_dict <dict> <hmm model> <idf> <stop words> <output.cpp>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include "DictTrie.hpp"
+#include "HMMModel.hpp"
+
+using namespace cppjieba;
+
+static bool ReadFile(const string& path, string& content) {
+  ifstream ifs(path.c_str(), ios::binary);
+  if (!ifs.is_open()) {
+    return false;
+  }
+  ostringstream oss;
+  oss << ifs.rdbuf();
+  content = oss.str();
+  return true;
+}
+
+static void WriteFile(ostream& os, const string& name, const string& content) {
+  // aligned like a mapped file, the images are used in place
+  os << "alignas(64) static const unsigned char " << name << "_DATA[] = {";
+  for (size_t i = 0; i < content.size(); i++) {
+    os << (i % 32 ? "" : "\n") << unsigned(static_cast<unsigned char>(content[i])) << ",";
+  }
+  // the extra 0 keeps an empty file from making an empty array
+  os << "0\n};\n";
+  os << "const EmbeddedFile " << name << " = {" << name << "_DATA, " << content.size() << "};\n\n";
+}
+
+int main(int argc, char** argv) {
+  if (argc != 6) {
+    fprintf(stderr, "usage: %s <dict> <hmm model> <idf> <stop words> <output.cpp>\n", argv[0]);
+    return 1;
+  }
+  string output = argv[5];
+  string dictImagePath = output + ".dict.img";
+  string hmmImagePath = output + ".hmm.img";
+  DictTrie dict(argv[1]);
+  HMMModel model(argv[2]);
+  string dictImage, hmmImage, idf, stopWords;
+  bool ok = dict.SaveImage(dictImagePath) && model.SaveImage(hmmImagePath)
+    && ReadFile(dictImagePath, dictImage) && ReadFile(hmmImagePath, hmmImage)
+    && ReadFile(argv[3], idf) && ReadFile(argv[4], stopWords);
+  remove(dictImagePath.c_str());
+  remove(hmmImagePath.c_str());
+  if (!ok) {
+    fprintf(stderr, "%s: reading the input failed\n", argv[0]);
+    return 1;
+  }
+
+  ofstream ofs(output.c_str(), ios::trunc);
+  ofs << "// Generated by embed_dict, do not edit.\n";
+  ofs << "#include \"EmbeddedDict.hpp\"\n\n";
+  ofs << "namespace cppjieba {\n\n";
+  WriteFile(ofs, "EMBEDDED_DICT_IMAGE", dictImage);
+  WriteFile(ofs, "EMBEDDED_HMM_IMAGE", hmmImage);
+  WriteFile(ofs, "EMBEDDED_IDF", idf);
+  WriteFile(ofs, "EMBEDDED_STOP_WORDS", stopWords);
+  ofs << "} // namespace cppjieba\n";
+  if (!ofs.flush()) {
+    fprintf(stderr, "%s: writing %s failed\n", argv[0], output.c_str());
+    return 1;
+  }
+  return 0;
+}